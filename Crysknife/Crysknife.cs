@@ -72,31 +72,112 @@ internal static class Launcher
         if (Arguments.ContainsKey("d") || Arguments.ContainsKey("dry-run")) Options |= JobOptions.DryRun;
         if (Arguments.ContainsKey("v") || Arguments.ContainsKey("verbose")) Options |= JobOptions.Verbose;
         if (Arguments.ContainsKey("t") || Arguments.ContainsKey("treat-patch-as-file")) Options |= JobOptions.TreatPatchAsFile;
+        if (Arguments.ContainsKey("c") || Arguments.ContainsKey("cascade")) Options |= JobOptions.Cascade;
+        if (Arguments.ContainsKey("r") || Arguments.ContainsKey("refresh")) Options |= JobOptions.Refresh;
+        if (Arguments.ContainsKey("k") || Arguments.ContainsKey("token-match")) Options |= JobOptions.TokenMatch;
+        if (Arguments.ContainsKey("token-diff")) Options |= JobOptions.TokenDiff;
+        if (Arguments.ContainsKey("record-scopes")) Options |= JobOptions.RecordScopes;
+        if (Arguments.ContainsKey("x") || Arguments.ContainsKey("relocate")) Options |= JobOptions.Relocate;
+        if (Arguments.ContainsKey("report")) Options |= JobOptions.Report;
 
         var InjectorInstance = new Injector(ProjectName, SrcDirectory, DstDirectory, Options);
         var Job = JobType.None;
 
         if (Arguments.TryGetValue("i", out Parameters)) InjectorInstance.InclusiveFilter = Parameters;
         if (Arguments.TryGetValue("e", out Parameters)) InjectorInstance.ExclusiveFilter = Parameters;
-        if (Arguments.TryGetValue("patch-context", out Parameters)) InjectorInstance.PatchContextLength = short.Parse(Parameters);
+        if (Arguments.TryGetValue("patch-context", out Parameters))
+        {
+            InjectorInstance.PatchContextLength = Parameters == "unique" ? Injector.UniquePatchContext : short.Parse(Parameters);
+        }
         if (Arguments.TryGetValue("content-tolerance", out Parameters)) InjectorInstance.MatchContentTolerance = float.Parse(Parameters);
+        if (Arguments.TryGetValue("max-content-tolerance", out Parameters)) InjectorInstance.MaxMatchContentTolerance = float.Parse(Parameters);
         if (Arguments.TryGetValue("line-tolerance", out Parameters)) InjectorInstance.MatchLineTolerance = int.Parse(Parameters);
+        if (Arguments.TryGetValue("diff-budget", out Parameters)) InjectorInstance.DiffBudget = long.Parse(Parameters);
+        if (Arguments.TryGetValue("apply-cache-size", out Parameters)) InjectorInstance.ApplyCacheSize = long.Parse(Parameters) << 20;
+        if (Arguments.TryGetValue("shard", out Parameters)) InjectorInstance.Shard = ShardPlan.Parse(Parameters);
+        if (Arguments.TryGetValue("run-id", out Parameters)) InjectorInstance.RunId = Parameters;
+
+        if (Arguments.ContainsKey("merge-reports"))
+        {
+            bool Success = InjectorInstance.MergeShardReports();
+            Console.ResetColor();
+            if (!Success) Environment.ExitCode = 1;
+            return;
+        }
+
+        if (Arguments.ContainsKey("rollback"))
+        {
+            bool Success = InjectorInstance.Rollback();
+            Console.ResetColor();
+            if (!Success) Environment.ExitCode = 1;
+            return;
+        }
+
+        string BuiltinSourcePatch = Path.Combine(RootDirectory, RootFolderName, "SourcePatch");
+        if (Arguments.ContainsKey("verify"))
+        {
+            if (!Arguments.ContainsKey("B")) InjectorInstance.Process(JobType.Verify, BuiltinSourcePatch, VariableOverrides);
+            InjectorInstance.Process(JobType.Verify, VariableOverrides);
+            Console.ResetColor();
+            if (!InjectorInstance.IsVerified) Environment.ExitCode = 1;
+            return;
+        }
+
+        if (Arguments.TryGetValue("matrix", out Parameters))
+        {
+            var EngineDirectories = Parameters.Split(',', StringSplitOptions.RemoveEmptyEntries | StringSplitOptions.TrimEntries);
+            if (EngineDirectories.Length == 0)
+            {
+                Console.ForegroundColor = ConsoleColor.Yellow;
+                Console.WriteLine("Please specify the engine source directories to run the compatibility matrix against.");
+                Utils.Abort();
+                return;
+            }
+
+            bool Compatible = true;
+            if (!Arguments.ContainsKey("B")) Compatible &= InjectorInstance.ProcessMatrix(EngineDirectories, BuiltinSourcePatch, VariableOverrides);
+            Compatible &= InjectorInstance.ProcessMatrix(EngineDirectories, VariableOverrides);
+            Console.ResetColor();
+            if (!Compatible) Environment.ExitCode = 1;
+            return;
+        }
+
+        if (InjectorInstance.Shard.IsSharded && (Arguments.ContainsKey("R") || Arguments.ContainsKey("U") || Arguments.ContainsKey("M")))
+        {
+            Console.ForegroundColor = ConsoleColor.Red;
+            Console.WriteLine("Patch file management actions (-R, -U, -M) cannot be sharded, please run them separately.");
+            Utils.Abort();
+            return;
+        }
+
+        if (InjectorInstance.Shard.IsSharded && string.IsNullOrEmpty(InjectorInstance.RunId))
+        {
+            Console.ForegroundColor = ConsoleColor.Red;
+            Console.WriteLine("Sharded jobs need a '--run-id' shared by all shards, so that their reports can be told apart from previous runs.");
+            Utils.Abort();
+            return;
+        }
 
         if (Arguments.TryGetValue("R", out Parameters)) { InjectorInstance.CreatePatchFile(Parameters.Split()); Job = JobType.Generate; }
         if (Arguments.TryGetValue("U", out Parameters)) { InjectorInstance.RemovePatchFile(Parameters.Split()); Job = JobType.Generate; }
 
+        bool Migrated = false;
+        if (Arguments.TryGetValue("M", out Parameters)) { InjectorInstance.MigratePatches(Enum.Parse<PatchStorageMode>(Parameters, true)); Migrated = true; }
+
         if (Arguments.ContainsKey("G")) Job |= JobType.Generate;
         if (Arguments.ContainsKey("C")) Job |= JobType.Clear;
         if (Arguments.ContainsKey("A")) Job |= JobType.Apply;
+        if (Job == JobType.None && Migrated) { Console.ResetColor(); return; } // Migration only
         if (Job == JobType.None) Job = JobType.Apply; // By default do the apply action
 
-        if (!Arguments.ContainsKey("B"))
-        {
-            string BuiltinSourcePatch = Path.Combine(RootDirectory, RootFolderName, "SourcePatch");
-            InjectorInstance.Process(Job, BuiltinSourcePatch, VariableOverrides);
-        }
+        InjectorInstance.BeginTransaction();
+        if (!Arguments.ContainsKey("B")) InjectorInstance.Process(Job, BuiltinSourcePatch, VariableOverrides);
 
         InjectorInstance.Process(Job, VariableOverrides);
+        InjectorInstance.CommitTransaction();
+        InjectorInstance.TrimApplyCache();
+        InjectorInstance.RelocateFailedHunks();
+        InjectorInstance.WriteShardReport();
         Console.ResetColor();
     }
 }
@@ -0,0 +1,116 @@
+// SPDX-FileCopyrightText: 2024 Yun Hsiao Wu <yunhsiaow@gmail.com>
+// SPDX-License-Identifier: MIT
+
+using System.IO.Compression;
+
+namespace Crysknife;
+
+/// <summary>
+/// Local content-addressed cache of apply results, so that applying the same patches onto the same cleared targets
+/// with the same settings (e.g. after switching branches back and forth) skips matching entirely.
+/// Each entry is keyed by the hash of all its inputs, and stores the compressed result together with the hunk states.
+/// Least recently used entries are evicted when the cache exceeds its size limit.
+/// </summary>
+public class ApplyCache
+{
+    private const int CacheVersion = 1; // Bump whenever apply results may change for the same inputs
+    private const string TempExtension = ".tmp";
+
+    private readonly string CacheDirectory;
+    private readonly long SizeLimit;
+
+    public ApplyCache(string CacheDirectory, long SizeLimit)
+    {
+        this.CacheDirectory = Path.GetFullPath(CacheDirectory);
+        this.SizeLimit = SizeLimit;
+    }
+
+    public static string MakeKey(IEnumerable<string> Inputs)
+    {
+        return Utils.GetContentHash(string.Join('\n', Inputs.Prepend(CacheVersion.ToString())));
+    }
+
+    private string GetEntryPath(string Key)
+    {
+        return Path.Combine(CacheDirectory, Key[..2], Key);
+    }
+
+    public bool TryGet(string Key, out string PatchName, out string Patched, out bool[] IsSuccess, out float[] Tolerances)
+    {
+        PatchName = Patched = string.Empty;
+        IsSuccess = Array.Empty<bool>();
+        Tolerances = Array.Empty<float>();
+
+        string EntryPath = GetEntryPath(Key);
+        if (!File.Exists(EntryPath)) return false;
+        try
+        {
+            using (var Reader = new BinaryReader(new BrotliStream(File.OpenRead(EntryPath), CompressionMode.Decompress)))
+            {
+                PatchName = Reader.ReadString();
+                IsSuccess = new bool[Reader.ReadInt32()];
+                Tolerances = new float[IsSuccess.Length];
+                for (int Index = 0; Index < IsSuccess.Length; ++Index)
+                {
+                    IsSuccess[Index] = Reader.ReadBoolean();
+                    Tolerances[Index] = Reader.ReadSingle();
+                }
+                Patched = Reader.ReadString();
+            }
+            File.SetLastWriteTimeUtc(EntryPath, DateTime.UtcNow); // Recently used
+            return true;
+        }
+        catch (Exception)
+        {
+            return false; // Corrupted or being evicted by another instance, just apply again
+        }
+    }
+
+    public void Put(string Key, string PatchName, string Patched, bool[] IsSuccess, float[] Tolerances)
+    {
+        string EntryPath = GetEntryPath(Key);
+        string TempPath = $"{EntryPath}.{Environment.ProcessId}.{Environment.CurrentManagedThreadId}{TempExtension}";
+        try
+        {
+            Utils.EnsureParentDirectoryExists(EntryPath);
+            using (var Writer = new BinaryWriter(new BrotliStream(File.Create(TempPath), CompressionLevel.Fastest)))
+            {
+                Writer.Write(PatchName);
+                Writer.Write(IsSuccess.Length);
+                for (int Index = 0; Index < IsSuccess.Length; ++Index)
+                {
+                    Writer.Write(IsSuccess[Index]);
+                    Writer.Write(Tolerances[Index]);
+                }
+                Writer.Write(Patched);
+            }
+            File.Move(TempPath, EntryPath, true);
+        }
+        catch (Exception Ex) when (Ex is IOException or UnauthorizedAccessException)
+        {
+            // Caching is only an optimization, never fail the job for it
+            try { File.Delete(TempPath); }
+            catch (Exception) { }
+        }
+    }
+
+    /// <summary>
+    /// Evict least recently used entries until the cache fits in its size limit.
+    /// Temporary files are left alone, since they may still be written by other instances.
+    /// </summary>
+    public void Trim()
+    {
+        if (!Directory.Exists(CacheDirectory)) return;
+
+        var Entries = new DirectoryInfo(CacheDirectory).EnumerateFiles("*", SearchOption.AllDirectories)
+            .Where(Entry => Entry.Extension != TempExtension).OrderByDescending(Entry => Entry.LastWriteTimeUtc).ToList();
+        long TotalSize = 0;
+        foreach (var Entry in Entries)
+        {
+            TotalSize += Entry.Length;
+            if (TotalSize <= SizeLimit) continue;
+            try { Entry.Delete(); }
+            catch (Exception Ex) when (Ex is IOException or UnauthorizedAccessException) { } // Being read by another instance
+        }
+    }
+}
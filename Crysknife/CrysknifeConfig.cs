@@ -2,25 +2,332 @@
 // SPDX-License-Identifier: MIT
 
 using System.Diagnostics;
+using System.Text;
+using System.Text.RegularExpressions;
 
 namespace Crysknife;
 
+internal enum ConfigMatchKind
+{
+    Substring, // Against the file name
+    Glob, // Against the whole relative path
+    Regex, // Searched inside the whole relative path
+}
+
+/// <summary>
+/// Matches all the registered conditions against the input in one pass, case-insensitively:
+/// Substrings are fed into an Aho-Corasick automaton, while globs are combined into one regex.
+/// User regexes are matched separately, so that their numbered groups & backreferences stay intact.
+/// </summary>
+internal class ConfigNameMatcher
+{
+    private readonly Dictionary<string, int> NeedleIds = new();
+    private readonly List<Dictionary<char, int>> Transitions = new() { new Dictionary<char, int>() };
+    private readonly List<int> Failures = new() { 0 };
+    private readonly List<List<int>> Outputs = new() { new List<int>() };
+    private int[][] CompiledOutputs = Array.Empty<int[]>();
+    private readonly List<int> EmptyNeedles = new();
+
+    private readonly Dictionary<string, int> PatternIds = new();
+    private readonly List<string> Patterns = new();
+    private Regex? CompiledPatterns;
+    private int[] PatternGroups = Array.Empty<int>();
+    private readonly Dictionary<string, int> RegexIds = new();
+    private (int Id, Regex Pattern)[] CompiledRegexes = Array.Empty<(int, Regex)>();
+
+    private const RegexOptions PatternOptions = RegexOptions.Compiled | RegexOptions.IgnoreCase | RegexOptions.CultureInvariant | RegexOptions.Singleline;
+
+    public int Count { get; private set; }
+
+    public int Add(ConfigMatchKind Kind, string Condition)
+    {
+        switch (Kind)
+        {
+            case ConfigMatchKind.Substring:
+                return Add(Condition);
+            case ConfigMatchKind.Glob:
+                return AddPattern($"{GlobToRegex(Utils.UnifySeparators(Condition))}\\z");
+            case ConfigMatchKind.Regex:
+                return AddRegex(Condition);
+            default:
+                throw new ArgumentOutOfRangeException(nameof(Kind), Kind, null);
+        }
+    }
+
+    private int AddPattern(string Pattern)
+    {
+        if (PatternIds.TryGetValue(Pattern, out var Id)) return Id;
+
+        Id = Count++;
+        PatternIds.Add(Pattern, Id);
+        Patterns.Add($"(?:(?=(?<_{Id}>{Pattern}))|)");
+        return Id;
+    }
+
+    private int AddRegex(string Pattern)
+    {
+        if (RegexIds.TryGetValue(Pattern, out var Id)) return Id;
+
+        Id = Count++;
+        RegexIds.Add(Pattern, Id);
+        return Id;
+    }
+
+    public static string GlobToRegex(string Glob)
+    {
+        const string Separator = @"[/\\]";
+        const string NonSeparator = @"[^/\\]";
+
+        var Builder = new StringBuilder("^");
+        for (int Index = 0; Index < Glob.Length; ++Index)
+        {
+            char Char = Glob[Index];
+            switch (Char)
+            {
+                case '*' when Index + 1 < Glob.Length && Glob[Index + 1] == '*':
+                    ++Index;
+                    bool Directories = Index + 1 < Glob.Length && (Glob[Index + 1] == '/' || Glob[Index + 1] == '\\');
+                    if (Directories) ++Index;
+                    Builder.Append(Directories ? $"(?:.*{Separator})?" : ".*");
+                    break;
+                case '*':
+                    Builder.Append(NonSeparator).Append('*');
+                    break;
+                case '?':
+                    Builder.Append(NonSeparator);
+                    break;
+                case '/' or '\\':
+                    Builder.Append(Separator);
+                    break;
+                case '[':
+                    int End = Glob.IndexOf(']', Index + 1);
+                    if (End < 0) goto default;
+                    string Set = Glob[(Index + 1)..End];
+                    Builder.Append('[').Append(Set.StartsWith('!') ? "^" + Set[1..] : Set).Append(']');
+                    Index = End;
+                    break;
+                default:
+                    Builder.Append(Regex.Escape(Char.ToString()));
+                    break;
+            }
+        }
+        return Builder.ToString();
+    }
+
+    private int Add(string Needle)
+    {
+        Needle = Needle.ToUpperInvariant();
+        if (NeedleIds.TryGetValue(Needle, out var Id)) return Id;
+
+        Id = Count++;
+        NeedleIds.Add(Needle, Id);
+        if (Needle.Length == 0) EmptyNeedles.Add(Id); // Always matches
+
+        int State = 0;
+        foreach (char Char in Needle)
+        {
+            if (!Transitions[State].TryGetValue(Char, out var Next))
+            {
+                Next = Transitions.Count;
+                Transitions.Add(new Dictionary<char, int>());
+                Failures.Add(0);
+                Outputs.Add(new List<int>());
+                Transitions[State].Add(Char, Next);
+            }
+            State = Next;
+        }
+        if (Needle.Length > 0) Outputs[State].Add(Id);
+        return Id;
+    }
+
+    public void Build()
+    {
+        // BFS over the trie to setup failure links, merging outputs along the way
+        var Queue = new Queue<int>(Transitions[0].Values);
+        while (Queue.Count > 0)
+        {
+            int State = Queue.Dequeue();
+            foreach (var Pair in Transitions[State])
+            {
+                int Failure = Failures[State];
+                while (Failure != 0 && !Transitions[Failure].ContainsKey(Pair.Key)) Failure = Failures[Failure];
+                Failures[Pair.Value] = Transitions[Failure].TryGetValue(Pair.Key, out var Next) && Next != Pair.Value ? Next : 0;
+                Outputs[Pair.Value].AddRange(Outputs[Failures[Pair.Value]]);
+                Queue.Enqueue(Pair.Value);
+            }
+        }
+        CompiledOutputs = Outputs.Select(Output => Output.ToArray()).ToArray();
+
+        CompiledRegexes = RegexIds.Select(Pair => (Pair.Value, new Regex(Pair.Key, PatternOptions))).ToArray();
+        if (Patterns.Count == 0) return;
+        CompiledPatterns = new Regex("^" + string.Concat(Patterns), PatternOptions);
+        PatternGroups = PatternIds.Values.Select(Id => CompiledPatterns.GroupNumberFromName($"_{Id}")).ToArray();
+    }
+
+    public void Match(ReadOnlySpan<char> Input, string PathInput, Span<bool> Matched)
+    {
+        Matched.Clear();
+        foreach (int Id in EmptyNeedles) Matched[Id] = true;
+
+        int State = 0;
+        foreach (char Char in Input)
+        {
+            char Upper = char.ToUpperInvariant(Char);
+            int Next;
+            while (!Transitions[State].TryGetValue(Upper, out Next) && State != 0) State = Failures[State];
+            State = Next;
+            foreach (int Id in CompiledOutputs[State]) Matched[Id] = true;
+        }
+
+        foreach (var (Id, Pattern) in CompiledRegexes)
+        {
+            if (Pattern.IsMatch(PathInput)) Matched[Id] = true;
+        }
+
+        if (CompiledPatterns == null) return;
+        var Groups = CompiledPatterns.Match(PathInput).Groups;
+        int PatternIndex = 0;
+        foreach (int Id in PatternIds.Values)
+        {
+            if (Groups[PatternGroups[PatternIndex++]].Success) Matched[Id] = true;
+        }
+    }
+}
+
+/// <summary>
+/// Multi-pattern path filter: plain patterns are case-sensitive substrings of the full path, while
+/// the ones containing wildcards are globs against the path relative to the source directory.
+/// </summary>
+internal class ConfigPathFilter
+{
+    private readonly ConfigNameMatcher Matcher = new();
+    public readonly string[] Patterns;
+    private readonly string[] Substrings;
+
+    // Per-segment regexes of every glob pattern for subtree queries, null for '**'
+    private readonly List<Regex?[]> GlobSegments = new();
+
+    public ConfigPathFilter(string Patterns)
+    {
+        this.Patterns = Patterns.Split(new[] { '|', ',' }, Utils.SplitOptions).Select(Utils.UnifySeparators).ToArray();
+        Substrings = this.Patterns.Where(Pattern => !IsGlob(Pattern)).ToArray();
+        foreach (string Pattern in this.Patterns.Where(IsGlob))
+        {
+            Matcher.Add(ConfigMatchKind.Glob, Pattern);
+            GlobSegments.Add(Pattern.Split(Path.DirectorySeparatorChar, Utils.SplitOptions).Select(Segment => Segment == "**" ? null :
+                new Regex(ConfigNameMatcher.GlobToRegex(Segment) + "\\z", RegexOptions.IgnoreCase | RegexOptions.CultureInvariant)).ToArray());
+        }
+        Matcher.Build();
+    }
+
+    private static bool CanMatchUnder(Regex?[] Glob, int GlobIndex, string[] Directory, int DirectoryIndex)
+    {
+        if (DirectoryIndex == Directory.Length) return GlobIndex < Glob.Length; // Something has to be left for the files
+        if (GlobIndex == Glob.Length) return false;
+        if (Glob[GlobIndex] == null) return CanMatchUnder(Glob, GlobIndex + 1, Directory, DirectoryIndex) || CanMatchUnder(Glob, GlobIndex, Directory, DirectoryIndex + 1);
+        return Glob[GlobIndex]!.IsMatch(Directory[DirectoryIndex]) && CanMatchUnder(Glob, GlobIndex + 1, Directory, DirectoryIndex + 1);
+    }
+
+    private static bool MatchesAllUnder(Regex?[] Glob, int GlobIndex, string[] Directory, int DirectoryIndex)
+    {
+        if (DirectoryIndex == Directory.Length) return GlobIndex < Glob.Length && Glob[GlobIndex..].All(Segment => Segment == null);
+        if (GlobIndex == Glob.Length) return false;
+        if (Glob[GlobIndex] == null) return MatchesAllUnder(Glob, GlobIndex + 1, Directory, DirectoryIndex) || MatchesAllUnder(Glob, GlobIndex, Directory, DirectoryIndex + 1);
+        return Glob[GlobIndex]!.IsMatch(Directory[DirectoryIndex]) && MatchesAllUnder(Glob, GlobIndex + 1, Directory, DirectoryIndex + 1);
+    }
+
+    /// <summary>
+    /// Whether any file inside the specified directory could possibly match.
+    /// </summary>
+    public bool CanMatchUnder(string RelativeDirectory)
+    {
+        if (GlobSegments.Count < Patterns.Length) return true; // Substrings can always show up in deeper names
+        var Directory = RelativeDirectory.Split(Path.DirectorySeparatorChar, Utils.SplitOptions);
+        return GlobSegments.Any(Glob => CanMatchUnder(Glob, 0, Directory, 0));
+    }
+
+    /// <summary>
+    /// Whether all the files inside the specified directory are guaranteed to match.
+    /// </summary>
+    public bool MatchesAllUnder(string FullDirectory, string RelativeDirectory)
+    {
+        string Prefix = FullDirectory + Path.DirectorySeparatorChar;
+        if (Substrings.Any(Pattern => Prefix.Contains(Pattern, StringComparison.Ordinal))) return true;
+        var Directory = RelativeDirectory.Split(Path.DirectorySeparatorChar, Utils.SplitOptions);
+        return GlobSegments.Any(Glob => MatchesAllUnder(Glob, 0, Directory, 0));
+    }
+
+    public static bool IsGlob(string Pattern)
+    {
+        return Pattern.IndexOfAny(new[] { '*', '?', '[' }) >= 0;
+    }
+
+    public bool IsEmpty => Patterns.Length == 0;
+
+    public bool Matches(string FullPath, string RelativePath)
+    {
+        if (Substrings.Any(Pattern => FullPath.Contains(Pattern, StringComparison.Ordinal))) return true;
+        if (Matcher.Count == 0) return false;
+        Span<bool> Matched = Matcher.Count <= 256 ? stackalloc bool[Matcher.Count] : new bool[Matcher.Count];
+        Matcher.Match(FullPath, RelativePath, Matched);
+        return Matched.Contains(true);
+    }
+}
+
+/// <summary>
+/// Shared state for compiling config sections, recording every filesystem probe the result depends on.
+/// </summary>
+internal class ConfigCompileContext
+{
+    public readonly string RootPath;
+    public readonly IDictionary<string, string> Variables;
+    public readonly ConfigNameMatcher Matcher;
+    public readonly Dictionary<string, bool> Probes = new();
+
+    public ConfigCompileContext(string RootPath, IDictionary<string, string> Variables, ConfigNameMatcher Matcher)
+    {
+        this.RootPath = RootPath;
+        this.Variables = Variables;
+        this.Matcher = Matcher;
+    }
+
+    public static bool Probe(string TargetPath)
+    {
+        return File.Exists(TargetPath) || Directory.Exists(TargetPath);
+    }
+
+    public bool TargetExists(string Cond)
+    {
+        string TargetPath = Path.Combine(RootPath, Cond);
+        if (Probes.TryGetValue(TargetPath, out var Exists)) return Exists;
+        Exists = Probe(TargetPath);
+        Probes.Add(TargetPath, Exists);
+        return Exists;
+    }
+}
+
 internal class ConfigPredicate
 {
     public readonly bool CompileTime;
 
     public readonly string Keyword;
-    public readonly Func<string, bool> EvalFunc = _ => true;
-    public readonly Func<string, Func<string, bool>> EvalFuncFactory = _ => _ => true;
+    private readonly Func<string, bool> EvalFunc = _ => true;
+    private readonly ConfigNameMatcher? Matcher;
+    private readonly ConfigMatchKind Kind;
 
     private readonly List<string> Conditions = new();
+    private int[] ConditionIds = Array.Empty<int>();
     private bool LogicalAnd;
 
-    public ConfigPredicate(string Keyword, Func<string, Func<string, bool>> EvalFuncFactory)
+    /// <summary>
+    /// Runtime predicate, evaluated on the target path through the shared matcher.
+    /// </summary>
+    public ConfigPredicate(string Keyword, ConfigNameMatcher Matcher, ConfigMatchKind Kind)
     {
         CompileTime = false;
         this.Keyword = Keyword;
-        this.EvalFuncFactory = EvalFuncFactory;
+        this.Matcher = Matcher;
+        this.Kind = Kind;
     }
 
     public ConfigPredicate(string Keyword, Func<string, bool> EvalFunc)
@@ -30,16 +337,50 @@ internal class ConfigPredicate
         this.EvalFunc = EvalFunc;
     }
 
-    public bool Eval(Func<string, bool> Pred)
+    public ConfigPredicate(BinaryReader Reader, ConfigNameMatcher Matcher)
+    {
+        CompileTime = Reader.ReadBoolean();
+        Keyword = Reader.ReadString();
+        Kind = (ConfigMatchKind)Reader.ReadInt32();
+        LogicalAnd = Reader.ReadBoolean();
+        for (int Count = Reader.ReadInt32(); Count > 0; --Count) Conditions.Add(Reader.ReadString());
+
+        // Compile time results are already folded into the snapshot
+        if (CompileTime) return;
+        this.Matcher = Matcher;
+        Compile();
+    }
+
+    public void Write(BinaryWriter Writer)
+    {
+        Writer.Write(CompileTime);
+        Writer.Write(Keyword);
+        Writer.Write((int)Kind);
+        Writer.Write(LogicalAnd);
+        Writer.Write(Conditions.Count);
+        foreach (string Cond in Conditions) Writer.Write(Cond);
+    }
+
+    public bool Eval()
     {
         var Wrapper = (string Cond) =>
         {
             bool Invert = Cond.StartsWith('!');
-            return Invert ? !Pred(Cond[1..]) : Pred(Cond);
+            return Invert ? !EvalFunc(Cond[1..]) : EvalFunc(Cond);
         };
         return LogicalAnd ? Conditions.All(Wrapper) : Conditions.Any(Wrapper);
     }
 
+    public bool Eval(ReadOnlySpan<bool> Matched)
+    {
+        for (int Index = 0; Index < ConditionIds.Length; ++Index)
+        {
+            bool Result = Matched[ConditionIds[Index]] ^ Conditions[Index].StartsWith('!');
+            if (Result ^ LogicalAnd) return Result; // Early out if possible
+        }
+        return LogicalAnd;
+    }
+
     public bool IsValid()
     {
         return Conditions.Count > 0;
@@ -55,6 +396,12 @@ internal class ConfigPredicate
         Conditions.AddRange(Input);
     }
 
+    public void Compile()
+    {
+        if (Matcher == null) return;
+        ConditionIds = Conditions.Select(Cond => Matcher.Add(Kind, Cond.StartsWith('!') ? Cond[1..] : Cond)).ToArray();
+    }
+
     public override string ToString()
     {
         string LogicOp = LogicalAnd ? "Conjunction|" : "";
@@ -67,6 +414,7 @@ internal class ConfigPredicates
     private readonly List<string> Descriptions = new();
 
     private ConfigPredicate[] Predicates = Array.Empty<ConfigPredicate>();
+    private ConfigPredicate[] RuntimePredicates = Array.Empty<ConfigPredicate>();
     private bool CompileTimeCondition;
     private bool LogicalAnd; // By default all predicates are disjunction
 
@@ -75,17 +423,21 @@ internal class ConfigPredicates
         return LogicalAnd ? Result && NewResult : Result || NewResult;
     }
 
-    private bool Eval(bool Result, ConfigPredicate Predicate, Func<string, bool> Pred)
+    public bool Eval(ReadOnlySpan<bool> Matched)
     {
-        if (Result ^ LogicalAnd) return Result; // Early out if possible
-        return Eval(Result, Predicate.IsValid() ? Predicate.Eval(Pred) : LogicalAnd);
+        bool Result = CompileTimeCondition;
+        foreach (var Predicate in RuntimePredicates)
+        {
+            if (Result ^ LogicalAnd) return Result; // Early out if possible
+            Result = Eval(Result, Predicate.Eval(Matched));
+        }
+        return Result;
     }
 
-    public bool Eval(string Target)
-    {
-        return Predicates.Where(Predicate => !Predicate.CompileTime).Aggregate(CompileTimeCondition, (Current, Predicate) =>
-            Eval(Current, Predicate, Predicate.EvalFuncFactory(Target)));
-    }
+    /// <summary>
+    /// Whether the result is already decided at compile time, regardless of the target.
+    /// </summary>
+    public bool IsConstant => RuntimePredicates.Length == 0 || CompileTimeCondition ^ LogicalAnd;
 
     public void Add(string Desc, ConfigLineAction Action)
     {
@@ -108,18 +460,15 @@ internal class ConfigPredicates
         }
     }
 
-    public void Compile(string RootPath, IDictionary<string, string> Variables)
+    public void Compile(ConfigCompileContext Context)
     {
         Predicates = new[]
         {
-            new ConfigPredicate("NameMatches", Target => Cond =>
-                Path.GetFileName(Target).Contains(Cond, StringComparison.OrdinalIgnoreCase)),
+            new ConfigPredicate("NameMatches", Context.Matcher, ConfigMatchKind.Substring),
+            new ConfigPredicate("PathGlob", Context.Matcher, ConfigMatchKind.Glob),
+            new ConfigPredicate("PathRegex", Context.Matcher, ConfigMatchKind.Regex),
 
-            new ConfigPredicate("TargetExists", Cond =>
-            {
-                string TargetPath = Path.Combine(RootPath, Cond);
-                return File.Exists(TargetPath) || Directory.Exists(TargetPath);
-            }),
+            new ConfigPredicate("TargetExists", Context.TargetExists),
             new ConfigPredicate("IsTruthy", Utils.IsTruthyValue),
         };
 
@@ -163,7 +512,7 @@ internal class ConfigPredicates
                 }
                 Predicate.AddRange(Rule[(Predicate.Keyword.Length + 1)..]
                     .Split('|', Utils.SplitOptions)
-                    .Select(Value => Utils.MapVariables(Variables, Value)));
+                    .Select(Value => Utils.MapVariables(Context.Variables, Value)));
             }
         }
 
@@ -171,9 +520,32 @@ internal class ConfigPredicates
         {
             if (Predicate.CompileTime)
             {
-                CompileTimeCondition = Eval(CompileTimeCondition, Predicate, Predicate.EvalFunc);
+                if (CompileTimeCondition ^ LogicalAnd) continue; // Early out if possible
+                CompileTimeCondition = Eval(CompileTimeCondition, Predicate.IsValid() ? Predicate.Eval() : LogicalAnd);
+            }
+            else
+            {
+                Predicate.Compile();
             }
         }
+        RuntimePredicates = Predicates.Where(Predicate => !Predicate.CompileTime && Predicate.IsValid()).ToArray();
+    }
+
+    public void Read(BinaryReader Reader, ConfigNameMatcher Matcher)
+    {
+        LogicalAnd = Reader.ReadBoolean();
+        CompileTimeCondition = Reader.ReadBoolean();
+        Predicates = new ConfigPredicate[Reader.ReadInt32()];
+        for (int Index = 0; Index < Predicates.Length; ++Index) Predicates[Index] = new ConfigPredicate(Reader, Matcher);
+        RuntimePredicates = Predicates.Where(Predicate => !Predicate.CompileTime && Predicate.IsValid()).ToArray();
+    }
+
+    public void Write(BinaryWriter Writer)
+    {
+        Writer.Write(LogicalAnd);
+        Writer.Write(CompileTimeCondition);
+        Writer.Write(Predicates.Length);
+        foreach (var Predicate in Predicates) Predicate.Write(Writer);
     }
 
     public override string ToString()
@@ -206,17 +578,37 @@ internal class ConfigRule
         }
     }
 
-    public void Compile(string RootPath, IDictionary<string, string> Variables)
+    public void Compile(ConfigCompileContext Context)
+    {
+        BasePredicates.Compile(Context);
+        UserPredicates.Compile(Context);
+    }
+
+    public void Read(BinaryReader Reader, ConfigNameMatcher Matcher)
+    {
+        BasePredicates.Read(Reader, Matcher);
+        UserPredicates.Read(Reader, Matcher);
+    }
+
+    public void Write(BinaryWriter Writer)
     {
-        BasePredicates.Compile(RootPath, Variables);
-        UserPredicates.Compile(RootPath, Variables);
+        BasePredicates.Write(Writer);
+        UserPredicates.Write(Writer);
     }
 
-    public bool Eval(string Target)
+    public bool Eval(ReadOnlySpan<bool> Matched)
     {
-        return BasePredicates.Eval(Target) || UserPredicates.Eval(Target);
+        return BasePredicates.Eval(Matched) || UserPredicates.Eval(Matched);
     }
 
+    public bool IsConstant => BasePredicates.IsConstant && UserPredicates.IsConstant;
+
+    /// <summary>
+    /// Whether the rule is satisfied regardless of the target.
+    /// </summary>
+    public bool IsAlways => BasePredicates.IsConstant && BasePredicates.Eval(ReadOnlySpan<bool>.Empty) ||
+        UserPredicates.IsConstant && UserPredicates.Eval(ReadOnlySpan<bool>.Empty);
+
     public override string ToString()
     {
         string BaseDump = BasePredicates.ToString();
@@ -246,24 +638,22 @@ internal class ConfigSection
     private readonly string[] TargetNames;
 
     private readonly string RemapTarget = string.Empty;
-    private readonly ConfigRule[] Rules;
+    private readonly ConfigRule[] Rules =
+    {
+        new ConfigRule("SkipIf"),
+        new ConfigRule("FlattenIf"),
+        new ConfigRule("RemapIf"),
+    };
 
-    public ConfigSection(ConfigFileSection Section, string SectionName, string RootPath, IDictionary<string, string> Variables)
+    public ConfigSection(ConfigFileSection Section, string SectionName, ConfigCompileContext Context)
     {
         TargetNames = GetTargetNames(SectionName).ToArray();
 
-        Rules = new[]
-        {
-            new ConfigRule("SkipIf"),
-            new ConfigRule("FlattenIf"),
-            new ConfigRule("RemapIf"),
-        };
-
         foreach (ConfigLine Line in Section.Lines)
         {
             if (Line.Key.Equals("RemapTarget", StringComparison.OrdinalIgnoreCase))
             {
-                RemapTarget = Utils.UnifySeparators(Utils.MapVariables(Variables, Line.Value));
+                RemapTarget = Utils.UnifySeparators(Utils.MapVariables(Context.Variables, Line.Value));
                 if (Path.IsPathFullyQualified(RemapTarget)) RemapTarget = Path.GetFullPath(RemapTarget);
             }
             else
@@ -281,17 +671,62 @@ internal class ConfigSection
 
         foreach (ConfigRule Rule in Rules)
         {
-            Rule.Compile(RootPath, Variables);
+            Rule.Compile(Context);
+        }
+        RequiresMatching = !Rules.All(Rule => Rule.IsConstant);
+    }
+
+    public ConfigSection(BinaryReader Reader, ConfigNameMatcher Matcher)
+    {
+        TargetNames = new string[Reader.ReadInt32()];
+        for (int Index = 0; Index < TargetNames.Length; ++Index) TargetNames[Index] = Reader.ReadString();
+        RemapTarget = Reader.ReadString();
+
+        foreach (ConfigRule Rule in Rules)
+        {
+            Rule.Read(Reader, Matcher);
+        }
+        RequiresMatching = !Rules.All(Rule => Rule.IsConstant);
+    }
+
+    public void Write(BinaryWriter Writer)
+    {
+        Writer.Write(TargetNames.Length);
+        foreach (string TargetName in TargetNames) Writer.Write(TargetName);
+        Writer.Write(RemapTarget);
+
+        foreach (ConfigRule Rule in Rules)
+        {
+            Rule.Write(Writer);
         }
     }
 
-    public RemapResult Remap(string Target, out string Result, bool VerboseLogging)
+    /// <summary>
+    /// Whether the remap decision depends on the target name matches, otherwise it's fully decided per directory.
+    /// </summary>
+    public readonly bool RequiresMatching;
+
+    /// <summary>
+    /// Whether every target under this section is skipped regardless of its name.
+    /// </summary>
+    public bool SkipsAll => Rules[0].IsAlways;
+
+    private string? GetControllingDomain(string Target)
+    {
+        foreach (string TargetName in TargetNames)
+        {
+            if (Target.StartsWith(TargetName, StringComparison.OrdinalIgnoreCase)) return TargetName;
+        }
+        return null;
+    }
+
+    public RemapResult Remap(string Target, ReadOnlySpan<bool> Matched, out string Result, bool VerboseLogging)
     {
         Result = Target;
-        var ControllingDomain = Array.Find(TargetNames, TargetName => Target.StartsWith(TargetName, StringComparison.OrdinalIgnoreCase));
+        var ControllingDomain = GetControllingDomain(Target);
         if (ControllingDomain == null) return RemapResult.DoNotAffect;
 
-        bool ShouldSkip = Rules[0].Eval(Target);
+        bool ShouldSkip = Rules[0].Eval(Matched);
         if (VerboseLogging && ShouldSkip)
         {
             Console.ForegroundColor = ConsoleColor.Gray;
@@ -300,14 +735,14 @@ internal class ConfigSection
 
         if (ShouldSkip) return RemapResult.Skipped;
 
-        bool ShouldFlatten = Rules[1].Eval(Target);
+        bool ShouldFlatten = Rules[1].Eval(Matched);
         if (ShouldFlatten && VerboseLogging)
         {
             Console.ForegroundColor = ConsoleColor.Gray;
             Console.WriteLine($"Config: Flattened '{Target}' due to [{GetSectionName()}] flatten conditions");
         }
 
-        bool ShouldRemap = Rules[2].Eval(Target);
+        bool ShouldRemap = Rules[2].Eval(Matched);
         if (ShouldRemap && VerboseLogging)
         {
             Console.ForegroundColor = ConsoleColor.Gray;
@@ -329,7 +764,7 @@ internal class ConfigSection
         return RemapResult.AsIs;
     }
 
-    private string GetSectionName()
+    public string GetSectionName()
     {
         return string.Join('|', TargetNames.Select(Name => Name.Length > 0 ? Name : "Global"));
     }
@@ -368,8 +803,21 @@ internal class ConfigSectionHierarchy
         }
     }
 
+    private readonly struct CachedDirectory
+    {
+        public readonly ConfigSectionHierarchy? Node; // Null if the directory is not fully inside the hierarchy
+        public readonly int SectionIndex;
+
+        public CachedDirectory(ConfigSectionHierarchy? Node, int SectionIndex)
+        {
+            this.Node = Node;
+            this.SectionIndex = SectionIndex;
+        }
+    }
+
     private ConfigFileSectionNode? Section;
-    private readonly Dictionary<string, ConfigSectionHierarchy> Children = new ();
+    private readonly Dictionary<ReadOnlyMemory<char>, ConfigSectionHierarchy> Children = new (OrdinalMemoryComparer.Instance);
+    private readonly Dictionary<ReadOnlyMemory<char>, CachedDirectory> DirectoryCache = new (OrdinalMemoryComparer.Instance);
 
     public void InheritancePatch(ConfigFileSection? Parent)
     {
@@ -389,24 +837,74 @@ internal class ConfigSectionHierarchy
         }
     }
 
-    private static ConfigFileSectionNode? GetNearestNode(ConfigSectionHierarchy Root, string Target)
+    private static ConfigSectionHierarchy? Walk(ConfigSectionHierarchy Root, ReadOnlyMemory<char> Target, ref ConfigFileSectionNode? Section)
     {
         var Node = Root;
-        var Section = Root.Section;
+        int Start = 0;
 
-        foreach (string Folder in Target.Split(Path.DirectorySeparatorChar, Utils.SplitOptions))
+        while (Start < Target.Length)
         {
-            if (!Node.Children.TryGetValue(Folder, out var Child)) break;
-            if (Child.Section != null) Section = Child.Section;
-            Node = Child;
+            int End = Target.Span[Start..].IndexOf(Path.DirectorySeparatorChar);
+            End = End < 0 ? Target.Length : Start + End;
+
+            if (End > Start)
+            {
+                if (!Node.Children.TryGetValue(Target[Start..End], out var Child)) return null;
+                if (Child.Section != null) Section = Child.Section;
+                Node = Child;
+            }
+            Start = End + 1;
         }
 
+        return Node;
+    }
+
+    private static ConfigFileSectionNode? GetNearestNode(ConfigSectionHierarchy Root, string Target)
+    {
+        var Section = Root.Section;
+        Walk(Root, Target.AsMemory(), ref Section);
         return Section;
     }
 
-    public static int? GetNearestSection(ConfigSectionHierarchy Root, string Target)
+    /// <summary>
+    /// Allocation-free lookup of the nearest section index, memoized per directory.
+    /// </summary>
+    public static int GetNearestSection(ConfigSectionHierarchy Root, string Target)
     {
-        return GetNearestNode(Root, Target)?.LinkedIndex;
+        int Separator = Target.LastIndexOf(Path.DirectorySeparatorChar);
+        var Directory = Separator < 0 ? ReadOnlyMemory<char>.Empty : Target.AsMemory(0, Separator);
+
+        if (!Root.DirectoryCache.TryGetValue(Directory, out var Cached))
+        {
+            var Section = Root.Section;
+            var Node = Walk(Root, Directory, ref Section);
+            Cached = new CachedDirectory(Node, Section?.LinkedIndex ?? -1);
+            Root.DirectoryCache.Add(Directory, Cached);
+        }
+
+        // Sections can be file-specific too
+        if (Cached.Node != null && Cached.Node.Children.Count > 0 &&
+            Cached.Node.Children.TryGetValue(Target.AsMemory(Separator + 1), out var Child) && Child.Section != null)
+        {
+            return Child.Section.LinkedIndex;
+        }
+        return Cached.SectionIndex;
+    }
+
+    private bool HasDescendantSections()
+    {
+        return Children.Values.Any(Child => Child.Section != null || Child.HasDescendantSections());
+    }
+
+    /// <summary>
+    /// Nearest section index controlling the whole subtree of the specified directory, -1 if it's not uniform.
+    /// </summary>
+    public static int GetSubtreeSection(ConfigSectionHierarchy Root, string Directory)
+    {
+        var Section = Root.Section;
+        var Node = Walk(Root, Directory.AsMemory(), ref Section);
+        if (Node != null && Node.HasDescendantSections()) return -1;
+        return Section?.LinkedIndex ?? -1;
     }
 
     public static void Link(ConfigSectionHierarchy Root, List<ConfigSection> Sections)
@@ -422,6 +920,28 @@ internal class ConfigSectionHierarchy
         }
     }
 
+    private static void Insert(ConfigSectionHierarchy Root, IEnumerable<string> TargetNames, ConfigFileSectionNode SectionNode)
+    {
+        foreach (string TargetName in TargetNames)
+        {
+            if (TargetName.Length == 0)
+            {
+                Root.Section = SectionNode;
+                continue;
+            }
+
+            TargetName.Split(Path.DirectorySeparatorChar, Utils.SplitOptions)
+                .Aggregate(Root, (Current, Folder) =>
+                {
+                    if (Current.Children.TryGetValue(Folder.AsMemory(), out var Child)) return Child;
+                    Child = new ConfigSectionHierarchy();
+                    Current.Children.Add(Folder.AsMemory(), Child);
+                    return Child;
+                })
+                .Section = SectionNode;
+        }
+    }
+
     public static ConfigSectionHierarchy Build(ConfigFile Config, IEnumerable<string> SectionNames)
     {
         var Root = new ConfigSectionHierarchy();
@@ -429,26 +949,22 @@ internal class ConfigSectionHierarchy
         foreach (string SectionName in SectionNames)
         {
             if (!Config.TryGetSection(SectionName, out var Section)) continue;
-            var SectionNode = new ConfigFileSectionNode(Section);
+            Insert(Root, ConfigSection.GetTargetNames(SectionName), new ConfigFileSectionNode(Section));
+        }
+        return Root;
+    }
 
-            foreach (string TargetName in ConfigSection.GetTargetNames(SectionName))
-            {
-                if (TargetName.Length == 0)
-                {
-                    Root.Section = SectionNode;
-                    continue;
-                }
+    /// <summary>
+    /// Rebuild from already compiled sections, where inheritance is baked in.
+    /// </summary>
+    public static ConfigSectionHierarchy Build(IEnumerable<ConfigSection> Sections)
+    {
+        var Root = new ConfigSectionHierarchy();
 
-                TargetName.Split(Path.DirectorySeparatorChar, Utils.SplitOptions)
-                    .Aggregate(Root, (Current, Folder) =>
-                    {
-                        if (Current.Children.TryGetValue(Folder, out var Child)) return Child;
-                        Child = new ConfigSectionHierarchy();
-                        Current.Children.Add(Folder, Child);
-                        return Child;
-                    })
-                    .Section = SectionNode;
-            }
+        foreach (var Section in Sections)
+        {
+            var TargetNames = Section.GetTargetNames();
+            Insert(Root, TargetNames, new ConfigFileSectionNode(new ConfigFileSection(string.Join('|', TargetNames))));
         }
         return Root;
     }
@@ -459,10 +975,21 @@ public class Config
     private readonly List<ConfigSection> Sections = new();
     private readonly ConfigSectionHierarchy Hierarchy;
     private readonly Dictionary<string, string> Variables = new();
+    private readonly ConfigNameMatcher Matcher = new();
+    private readonly Dictionary<string, bool> Probes;
+
+    private const int SnapshotVersion = 2;
+
+    /// <summary>
+    /// Whether this config is loaded directly from a compiled snapshot of previous runs.
+    /// </summary>
+    public readonly bool IsFromSnapshot;
 
     public Config(string ConfigPath, string RootPath, ConfigFile BaseConfig, string VariableOverrides)
     {
         ConfigFile Config = File.Exists(ConfigPath) ? new ConfigFile(ConfigPath, BaseConfig) : BaseConfig;
+        var Context = new ConfigCompileContext(RootPath, Variables, Matcher);
+        Probes = Context.Probes;
 
         // Override variables
         Config.AppendFromText("Variables", VariableOverrides.Replace("\"", string.Empty));
@@ -488,19 +1015,122 @@ public class Config
         {
             if (Config.TryGetSection(SectionName, out Section))
             {
-                Sections.Add(new ConfigSection(Section, SectionName, RootPath, Variables));
+                Sections.Add(new ConfigSection(Section, SectionName, Context));
             }
         }
         ConfigSectionHierarchy.Link(Hierarchy, Sections);
+        Matcher.Build();
+    }
+
+    private Config(BinaryReader Reader)
+    {
+        Probes = new Dictionary<string, bool>();
+        for (int Count = Reader.ReadInt32(); Count > 0; --Count) Probes.Add(Reader.ReadString(), Reader.ReadBoolean());
+        for (int Count = Reader.ReadInt32(); Count > 0; --Count) Variables.Add(Reader.ReadString(), Reader.ReadString());
+        for (int Count = Reader.ReadInt32(); Count > 0; --Count) Sections.Add(new ConfigSection(Reader, Matcher));
+
+        Hierarchy = ConfigSectionHierarchy.Build(Sections);
+        ConfigSectionHierarchy.Link(Hierarchy, Sections);
+        Matcher.Build();
+        IsFromSnapshot = true;
+    }
+
+    private static string GetSnapshotKey(string ConfigPath, string BaseConfigPath, string RootPath, string VariableOverrides)
+    {
+        string GetFileHash(string FilePath) => File.Exists(FilePath) ? Utils.GetContentHash(File.ReadAllText(FilePath)) : string.Empty;
+        return string.Join('\n', SnapshotVersion, RootPath, VariableOverrides,
+            GetFileHash(ConfigFile.RedirectsPath), GetFileHash(BaseConfigPath), GetFileHash(ConfigPath));
+    }
+
+    private static Config? ReadSnapshot(string SnapshotPath, string Key)
+    {
+        if (!File.Exists(SnapshotPath)) return null;
+        try
+        {
+            using var Reader = new BinaryReader(new MemoryStream(File.ReadAllBytes(SnapshotPath)));
+            if (Reader.ReadString() != Key) return null;
+
+            var Result = new Config(Reader);
+            // Compile time results are only valid if all the probed targets stay the same
+            return Result.Probes.All(Pair => ConfigCompileContext.Probe(Pair.Key) == Pair.Value) ? Result : null;
+        }
+        catch (Exception)
+        {
+            return null; // Corrupted or outdated snapshot, just recompile
+        }
+    }
+
+    private void WriteSnapshot(string SnapshotPath, string Key)
+    {
+        using var Stream = new MemoryStream();
+        using (var Writer = new BinaryWriter(Stream))
+        {
+            Writer.Write(Key);
+            Writer.Write(Probes.Count);
+            foreach (var Pair in Probes)
+            {
+                Writer.Write(Pair.Key);
+                Writer.Write(Pair.Value);
+            }
+            Writer.Write(Variables.Count);
+            foreach (var Pair in Variables)
+            {
+                Writer.Write(Pair.Key);
+                Writer.Write(Pair.Value);
+            }
+            Writer.Write(Sections.Count);
+            foreach (var Section in Sections) Section.Write(Writer);
+        }
+
+        Utils.EnsureParentDirectoryExists(SnapshotPath);
+        Utils.FileAccessGuard(() => File.WriteAllBytes(SnapshotPath, Stream.ToArray()), SnapshotPath);
+    }
+
+    /// <summary>
+    /// Load the compiled config from the snapshot if none of the inputs changed since last run, otherwise compile and update the snapshot.
+    /// </summary>
+    public static Config Load(string ConfigPath, string BaseConfigPath, string RootPath, string VariableOverrides, string SnapshotPath,
+        bool UpdateSnapshot = true)
+    {
+        string Key = GetSnapshotKey(ConfigPath, BaseConfigPath, RootPath, VariableOverrides);
+        var Result = ReadSnapshot(SnapshotPath, Key);
+        if (Result != null) return Result;
+
+        var BaseConfig = File.Exists(BaseConfigPath) ? new ConfigFile(BaseConfigPath) : new ConfigFile();
+        Result = new Config(ConfigPath, RootPath, BaseConfig, VariableOverrides);
+        if (UpdateSnapshot) Result.WriteSnapshot(SnapshotPath, Key);
+        return Result;
+    }
+
+    /// <summary>
+    /// Whether the whole directory can be skipped without looking at any file inside.
+    /// </summary>
+    public bool SkipsDirectory(string Directory, bool VerboseLogging = false)
+    {
+        int SectionIndex = ConfigSectionHierarchy.GetSubtreeSection(Hierarchy, Directory);
+        if (SectionIndex < 0 || !Sections[SectionIndex].SkipsAll) return false;
+
+        if (VerboseLogging)
+        {
+            Console.ForegroundColor = ConsoleColor.Gray;
+            Console.WriteLine($"Config: Skipped directory '{Directory}' due to [{Sections[SectionIndex].GetSectionName()}] skipping conditions");
+        }
+        return true;
     }
 
     public bool Remap(string Target, out string Result, bool VerboseLogging = false)
     {
         Result = Target;
-        var NearestSectionIndex = ConfigSectionHierarchy.GetNearestSection(Hierarchy, Target);
-        if (NearestSectionIndex == null) return true; // As-is if no rule is found
+        int NearestSectionIndex = ConfigSectionHierarchy.GetNearestSection(Hierarchy, Target);
+        if (NearestSectionIndex < 0) return true; // As-is if no rule is found
+
+        var Section = Sections[NearestSectionIndex];
+        Span<bool> Matched = Section.RequiresMatching && Matcher.Count <= 256 ? stackalloc bool[Matcher.Count] :
+            Section.RequiresMatching ? new bool[Matcher.Count] : Span<bool>.Empty;
+        // Path patterns see patch targets as the files they patch
+        if (Section.RequiresMatching) Matcher.Match(Path.GetFileName(Target.AsSpan()), PatchStorage.GetTargetPath(Target), Matched);
 
-        switch (Sections[NearestSectionIndex.Value].Remap(Target, out var Temp, VerboseLogging))
+        switch (Section.Remap(Target, Matched, out var Temp, VerboseLogging))
         {
             case RemapResult.AsIs:
                 return true;
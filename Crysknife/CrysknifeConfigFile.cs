@@ -247,13 +247,29 @@ public class ConfigFile
 	private static readonly Dictionary<string, Dictionary<string, string>> SectionKeyRemap = new();
 	private static readonly HashSet<string> WarnedKeys = new(StringComparer.InvariantCultureIgnoreCase);
 
+	private static string? RedirectsLocation;
+	private static bool RedirectsLoaded;
+
+	/// <summary>
+	/// Path to the special ConfigRedirects.ini file, read lazily only when any config text is actually parsed.
+	/// </summary>
+	public static string RedirectsPath => RedirectsLocation ?? string.Empty;
+
 	public static void Init(string RootDirectory)
 	{
+		RedirectsLocation = Path.Combine(RootDirectory, "ConfigRedirects.ini");
+	}
+
+	private static void EnsureRedirectsLoaded()
+	{
+		if (RedirectsLoaded || RedirectsLocation == null) return;
+		RedirectsLoaded = true;
+
 		Dictionary<string, ConfigFileSection> Sections = new(StringComparer.InvariantCultureIgnoreCase);
 		try
 		{
 			// read the special ConfigRedirects.ini file into sections
-			string ConfigRemapFile = Path.Combine(RootDirectory, "ConfigRedirects.ini");
+			string ConfigRemapFile = RedirectsLocation;
 			if (File.Exists(ConfigRemapFile))
 			{
 				ReadIntoSections(ConfigRemapFile, Sections, ConfigLineAction.Set);
@@ -294,11 +310,14 @@ public class ConfigFile
 
 	public ConfigFile(string Location, ConfigLineAction DefaultAction = ConfigLineAction.Set)
 	{
+		EnsureRedirectsLoaded();
 		ReadIntoSections(Location, Sections, DefaultAction);
 	}
 
 	public ConfigFile(string Location, ConfigFile BaseConfig, ConfigLineAction DefaultAction = ConfigLineAction.Set)
 	{
+		EnsureRedirectsLoaded();
+
 		// Merge base config sections first to preserve key order
 		foreach (string SectionName in BaseConfig.SectionNames)
 		{
@@ -312,6 +331,7 @@ public class ConfigFile
 
 	public void AppendFromText(string SectionName, string IniText, ConfigLineAction DefaultAction = ConfigLineAction.Set)
 	{
+		EnsureRedirectsLoaded();
 		foreach (string Setting in IniText.Split(',', StringSplitOptions.RemoveEmptyEntries))
 		{
 			SectionKeyRemap.TryGetValue(SectionName, out var CurrentRemap);
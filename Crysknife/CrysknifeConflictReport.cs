@@ -0,0 +1,89 @@
+// SPDX-FileCopyrightText: 2024 Yun Hsiao Wu <yunhsiaow@gmail.com>
+// SPDX-License-Identifier: MIT
+
+using System.Text;
+
+namespace Crysknife;
+
+/// <summary>
+/// HTML report of the hunks of one patch side by side, streamed directly to the file.
+/// Only the hunks that matter are written, instead of a diff of the whole file.
+/// </summary>
+public static class ConflictReport
+{
+    private const int BufferSize = 1 << 16;
+
+    private const string Header = @"<!DOCTYPE html>
+<html><head><meta charset=""utf-8""><style>
+body { font-family: sans-serif; }
+table { border-collapse: collapse; width: 100%; table-layout: fixed; margin-bottom: 2em; }
+th, td { border: 1px solid #ccc; padding: 4px; vertical-align: top; text-align: left; }
+pre { margin: 0; white-space: pre-wrap; }
+del { background: #ffcccc; text-decoration: none; }
+ins { background: #ccffcc; text-decoration: none; }
+.failed { color: #c00; }
+.applied { color: #080; }
+</style></head><body>
+";
+
+    /// <summary>
+    /// Each hunk is written as its source text with deletions on the left, and its result with insertions on the right.
+    /// </summary>
+    public static void Write(string ReportPath, string TargetPath, string PatchPath, IReadOnlyList<DiffMatchPatch.Patch> Hunks,
+        IReadOnlyList<bool> IsSuccess, IReadOnlyList<int> Lines, bool FailedOnly)
+    {
+        using var Writer = new StreamWriter(ReportPath, false, new UTF8Encoding(false), BufferSize);
+        Writer.Write(Header);
+        Writer.Write("<h1>");
+        WriteEscaped(Writer, TargetPath);
+        Writer.Write("</h1>\n<p>Patch: ");
+        WriteEscaped(Writer, PatchPath);
+        Writer.Write($"<br>{IsSuccess.Count(V => !V)} of {IsSuccess.Count} hunk(s) failed, merge them manually and remember the comment guards</p>\n");
+
+        for (int Index = 0; Index < Hunks.Count; ++Index)
+        {
+            if (FailedOnly && IsSuccess[Index]) continue;
+
+            Writer.Write(IsSuccess[Index] ? "<h2 class=\"applied\">" : "<h2 class=\"failed\">");
+            Writer.Write($"Hunk {Index + 1} {(IsSuccess[Index] ? "applied" : "failed")}, originally near line {Lines[Index]}</h2>\n");
+            Writer.Write("<table><tr><th>Expected in target</th><th>Patched</th></tr>\n<tr><td><pre>");
+            WriteSide(Writer, Hunks[Index].diffs, DiffMatchPatch.Operation.DELETE, "del");
+            Writer.Write("</pre></td><td><pre>");
+            WriteSide(Writer, Hunks[Index].diffs, DiffMatchPatch.Operation.INSERT, "ins");
+            Writer.Write("</pre></td></tr></table>\n");
+        }
+        Writer.Write("</body></html>\n");
+    }
+
+    private static void WriteSide(TextWriter Writer, List<DiffMatchPatch.Diff> Diffs, DiffMatchPatch.Operation Operation, string Tag)
+    {
+        foreach (var Diff in Diffs)
+        {
+            if (Diff.operation == DiffMatchPatch.Operation.EQUAL)
+            {
+                WriteEscaped(Writer, Diff.text);
+            }
+            else if (Diff.operation == Operation)
+            {
+                Writer.Write($"<{Tag}>");
+                WriteEscaped(Writer, Diff.text);
+                Writer.Write($"</{Tag}>");
+            }
+        }
+    }
+
+    /// <summary>
+    /// Write everything between special characters as is, without making any intermediate string.
+    /// </summary>
+    private static void WriteEscaped(TextWriter Writer, string Text)
+    {
+        var Remaining = Text.AsSpan();
+        for (int Index = Remaining.IndexOfAny("&<>"); Index >= 0; Index = Remaining.IndexOfAny("&<>"))
+        {
+            Writer.Write(Remaining[..Index]);
+            Writer.Write(Remaining[Index] switch { '&' => "&amp;", '<' => "&lt;", _ => "&gt;" });
+            Remaining = Remaining[(Index + 1)..];
+        }
+        Writer.Write(Remaining);
+    }
+}
@@ -0,0 +1,378 @@
+// SPDX-FileCopyrightText: 2024 Yun Hsiao Wu <yunhsiaow@gmail.com>
+// SPDX-License-Identifier: MIT
+
+using System.IO.Enumeration;
+
+namespace Crysknife;
+
+/// <summary>
+/// Positions of every q-gram in one text, built once so that repeated occurrence queries
+/// only verify candidates from the rarest q-gram of the pattern instead of scanning the whole text.
+/// </summary>
+public class QGramIndex
+{
+    public const int Q = 8;
+
+    private readonly string Text;
+    private readonly Dictionary<int, List<int>> Postings = new();
+    private static readonly List<int> Empty = new();
+
+    public QGramIndex(string Text)
+    {
+        this.Text = Text;
+        for (int Index = 0; Index + Q <= Text.Length; ++Index)
+        {
+            int Hash = string.GetHashCode(Text.AsSpan(Index, Q));
+            if (!Postings.TryGetValue(Hash, out var Positions)) Postings.Add(Hash, Positions = new List<int>());
+            Positions.Add(Index);
+        }
+    }
+
+    private List<int> GetPostings(string Pattern, int Offset)
+    {
+        return Postings.TryGetValue(string.GetHashCode(Pattern.AsSpan(Offset, Q)), out var Positions) ? Positions : Empty;
+    }
+
+    /// <summary>
+    /// Start of every occurrence of the pattern in the text, in no particular order.
+    /// </summary>
+    private IEnumerable<int> Find(string Pattern)
+    {
+        if (Pattern.Length < Q)
+        {
+            for (int Index = Text.IndexOf(Pattern, StringComparison.Ordinal); Index >= 0;
+                 Index = Index + 1 < Text.Length ? Text.IndexOf(Pattern, Index + 1, StringComparison.Ordinal) : -1) yield return Index;
+            yield break;
+        }
+
+        int Rarest = 0;
+        for (int Offset = 1; Offset + Q <= Pattern.Length; ++Offset)
+        {
+            if (GetPostings(Pattern, Offset).Count < GetPostings(Pattern, Rarest).Count) Rarest = Offset;
+        }
+
+        foreach (int Position in GetPostings(Pattern, Rarest))
+        {
+            int Start = Position - Rarest;
+            if (Start < 0 || Start + Pattern.Length > Text.Length ||
+                string.CompareOrdinal(Text, Start, Pattern, 0, Pattern.Length) != 0) continue;
+            yield return Start;
+        }
+    }
+
+    /// <summary>
+    /// Number of occurrences of the pattern in the text, counting stops at the specified limit.
+    /// </summary>
+    public int Count(string Pattern, int Limit = int.MaxValue)
+    {
+        return Find(Pattern).Take(Limit).Count();
+    }
+
+    /// <summary>
+    /// Start of the only occurrence of the pattern in the text, or -1 if there are none or more than one.
+    /// </summary>
+    public int FindUnique(string Pattern)
+    {
+        int Result = -1;
+        foreach (int Start in Find(Pattern))
+        {
+            if (Result >= 0) return -1;
+            Result = Start;
+        }
+        return Result;
+    }
+}
+
+/// <summary>
+/// Inverted q-gram index over a whole source tree, to find where some text moved to across files.
+/// Each file is reduced to its winnowed fingerprints of whitespace-insensitive q-grams, cached on disk and only
+/// recomputed for files changed since last time. Any shared substring of at least Window + Q - 1 non-whitespace
+/// characters is guaranteed to share at least one fingerprint.
+/// </summary>
+public class SourceIndex
+{
+    private const int Window = 16;
+    private const int CacheVersion = 1;
+    private const uint HashBase = 0x01000193;
+    private const float MinFileScore = 0.5f;
+
+    public readonly struct Candidate
+    {
+        public readonly string FilePath;
+        public readonly int Line;
+        public readonly float Score; // Ratio of the query fingerprints found around the location
+
+        public Candidate(string FilePath, int Line, float Score)
+        {
+            this.FilePath = FilePath;
+            this.Line = Line;
+            this.Score = Score;
+        }
+    }
+
+    private readonly struct Entry
+    {
+        public readonly string RelativePath;
+        public readonly long Length;
+        public readonly long LastWriteTime;
+        public readonly uint[] Fingerprints; // Sorted and distinct
+
+        public Entry(string RelativePath, long Length, long LastWriteTime, uint[] Fingerprints)
+        {
+            this.RelativePath = RelativePath;
+            this.Length = Length;
+            this.LastWriteTime = LastWriteTime;
+            this.Fingerprints = Fingerprints;
+        }
+    }
+
+    private readonly string RootDirectory;
+    private readonly Entry[] Entries;
+
+    private SourceIndex(string RootDirectory, Entry[] Entries)
+    {
+        this.RootDirectory = RootDirectory;
+        this.Entries = Entries;
+    }
+
+    private static bool IsIndexed(string FilePath)
+    {
+        return Path.GetExtension(FilePath) is ".h" or ".hpp" or ".inl" or ".cpp" or ".c";
+    }
+
+    /// <summary>
+    /// All q-grams of the text with whitespaces and control characters skipped, hashed with a rolling polynomial
+    /// so that the results are stable across runs. Each comes with the offset of its first character in the text.
+    /// </summary>
+    private static List<(uint Hash, int Offset)> GetQGrams(string Text)
+    {
+        var Result = new List<(uint Hash, int Offset)>(Text.Length);
+        var Chars = new char[QGramIndex.Q];
+        var Offsets = new int[QGramIndex.Q];
+        uint Power = 1, Hash = 0;
+        for (int Index = 1; Index < QGramIndex.Q; ++Index) Power *= HashBase;
+
+        int Count = 0;
+        for (int Offset = 0; Offset < Text.Length; ++Offset)
+        {
+            char C = Text[Offset];
+            if (char.IsWhiteSpace(C) || char.IsControl(C)) continue;
+
+            int Slot = Count++ % QGramIndex.Q;
+            if (Count > QGramIndex.Q) Hash -= Chars[Slot] * Power;
+            Hash = Hash * HashBase + C;
+            Chars[Slot] = C;
+            Offsets[Slot] = Offset;
+            if (Count >= QGramIndex.Q) Result.Add((Hash, Offsets[Count % QGramIndex.Q]));
+        }
+        return Result;
+    }
+
+    /// <summary>
+    /// The rightmost minimal q-gram of every window, texts shorter than one window get their minimum.
+    /// </summary>
+    private static List<(uint Hash, int Offset)> GetFingerprints(string Text)
+    {
+        var Grams = GetQGrams(Text);
+        var Result = new List<(uint Hash, int Offset)>();
+        if (Grams.Count == 0) return Result;
+        if (Grams.Count < Window)
+        {
+            Result.Add(Grams.Aggregate((Min, Gram) => Gram.Hash <= Min.Hash ? Gram : Min));
+            return Result;
+        }
+
+        var Deque = new int[Grams.Count];
+        int Head = 0, Tail = 0, Picked = -1;
+        for (int Index = 0; Index < Grams.Count; ++Index)
+        {
+            while (Tail > Head && Grams[Deque[Tail - 1]].Hash >= Grams[Index].Hash) --Tail;
+            Deque[Tail++] = Index;
+            if (Deque[Head] <= Index - Window) ++Head;
+            if (Index < Window - 1 || Deque[Head] == Picked) continue;
+            Picked = Deque[Head];
+            Result.Add(Grams[Picked]);
+        }
+        return Result;
+    }
+
+    private static uint[] GetDistinctFingerprints(string Text)
+    {
+        return GetFingerprints(Text).Select(Fingerprint => Fingerprint.Hash).Distinct().OrderBy(Hash => Hash).ToArray();
+    }
+
+    private static Dictionary<string, Entry> ReadCache(string CachePath, string RootDirectory)
+    {
+        var Result = new Dictionary<string, Entry>();
+        if (!File.Exists(CachePath)) return Result;
+        try
+        {
+            using var Reader = new BinaryReader(new BufferedStream(File.OpenRead(CachePath)));
+            if (Reader.ReadInt32() != CacheVersion || Reader.ReadString() != RootDirectory) return Result;
+            for (int Count = Reader.ReadInt32(); Count > 0; --Count)
+            {
+                string RelativePath = Reader.ReadString();
+                long Length = Reader.ReadInt64(), LastWriteTime = Reader.ReadInt64();
+                var Fingerprints = new uint[Reader.ReadInt32()];
+                for (int Index = 0; Index < Fingerprints.Length; ++Index) Fingerprints[Index] = Reader.ReadUInt32();
+                Result[RelativePath] = new Entry(RelativePath, Length, LastWriteTime, Fingerprints);
+            }
+        }
+        catch (Exception)
+        {
+            Result.Clear(); // Corrupted or outdated cache, just rebuild
+        }
+        return Result;
+    }
+
+    private void WriteCache(string CachePath)
+    {
+        string TempPath = $"{CachePath}.{Environment.ProcessId}.tmp";
+        try
+        {
+            Utils.EnsureParentDirectoryExists(CachePath);
+            using (var Writer = new BinaryWriter(new BufferedStream(File.Create(TempPath))))
+            {
+                Writer.Write(CacheVersion);
+                Writer.Write(RootDirectory);
+                Writer.Write(Entries.Length);
+                foreach (var Entry in Entries)
+                {
+                    Writer.Write(Entry.RelativePath);
+                    Writer.Write(Entry.Length);
+                    Writer.Write(Entry.LastWriteTime);
+                    Writer.Write(Entry.Fingerprints.Length);
+                    foreach (uint Fingerprint in Entry.Fingerprints) Writer.Write(Fingerprint);
+                }
+            }
+            File.Move(TempPath, CachePath, true);
+        }
+        catch (Exception Ex) when (Ex is IOException or UnauthorizedAccessException)
+        {
+            // The cache is only an optimization, e.g. another instance may be replacing it at the same time
+            try { File.Delete(TempPath); }
+            catch (Exception) { }
+        }
+    }
+
+    /// <summary>
+    /// Load the index of all C++ sources under the root directory, third party libraries excluded.
+    /// Only files added or modified since the cached index was written are fingerprinted again.
+    /// </summary>
+    public static SourceIndex Load(string RootDirectory, string CachePath, bool VerboseLogging)
+    {
+        RootDirectory = Path.GetFullPath(RootDirectory);
+        var Cached = ReadCache(CachePath, RootDirectory);
+        var Files = new FileSystemEnumerable<FileInfo>(RootDirectory, (ref FileSystemEntry Entry) => (FileInfo)Entry.ToFileSystemInfo(),
+            new EnumerationOptions { RecurseSubdirectories = true })
+        {
+            ShouldIncludePredicate = (ref FileSystemEntry Entry) => !Entry.IsDirectory && IsIndexed(Entry.FileName.ToString()),
+            ShouldRecursePredicate = (ref FileSystemEntry Entry) => !Entry.FileName.Equals("ThirdParty", StringComparison.OrdinalIgnoreCase),
+        }.ToArray();
+
+        var Entries = new Entry[Files.Length];
+        int Updated = 0;
+        Parallel.For(0, Files.Length, Index =>
+        {
+            var Info = Files[Index];
+            string RelativePath = Path.GetRelativePath(RootDirectory, Info.FullName);
+            long LastWriteTime = Info.LastWriteTimeUtc.Ticks;
+            if (Cached.TryGetValue(RelativePath, out var Entry) && Entry.Length == Info.Length && Entry.LastWriteTime == LastWriteTime)
+            {
+                Entries[Index] = Entry;
+                return;
+            }
+            Entries[Index] = new Entry(RelativePath, Info.Length, LastWriteTime, GetDistinctFingerprints(File.ReadAllText(Info.FullName)));
+            Interlocked.Increment(ref Updated);
+        });
+
+        var Result = new SourceIndex(RootDirectory, Entries);
+        if (Updated > 0 || Cached.Count != Entries.Length) Result.WriteCache(CachePath);
+
+        if (VerboseLogging)
+        {
+            Console.ForegroundColor = ConsoleColor.Gray;
+            Console.WriteLine("Source index: {0} file(s), {1} updated", Entries.Length, Updated);
+        }
+        return Result;
+    }
+
+    /// <summary>
+    /// Find the best candidate locations of every query in one pass over the index:
+    /// Only fingerprints of the queries are inverted, files are ranked by how many of them they contain,
+    /// then the densest cluster in each top ranked file is reported.
+    /// </summary>
+    public List<Candidate>[] Search(IReadOnlyList<string> Queries, int MaxCandidates)
+    {
+        var QueryFingerprints = Queries.Select(GetDistinctFingerprints).ToArray();
+        var Postings = new Dictionary<uint, List<int>>();
+        for (int Query = 0; Query < QueryFingerprints.Length; ++Query)
+        {
+            foreach (uint Fingerprint in QueryFingerprints[Query])
+            {
+                if (!Postings.TryGetValue(Fingerprint, out var Matches)) Postings.Add(Fingerprint, Matches = new List<int>());
+                Matches.Add(Query);
+            }
+        }
+
+        var Ranked = Queries.Select(_ => new List<(int File, float Score)>()).ToArray();
+        Parallel.For(0, Entries.Length, () => new Dictionary<int, int>(), (FileIndex, _, Hits) =>
+        {
+            Hits.Clear();
+            foreach (uint Fingerprint in Entries[FileIndex].Fingerprints)
+            {
+                if (!Postings.TryGetValue(Fingerprint, out var Matches)) continue;
+                foreach (int Query in Matches) Hits[Query] = Hits.GetValueOrDefault(Query) + 1;
+            }
+            foreach (var (Query, Count) in Hits)
+            {
+                float Score = (float)Count / QueryFingerprints[Query].Length;
+                if (Score < MinFileScore) continue;
+                lock (Ranked[Query]) Ranked[Query].Add((FileIndex, Score));
+            }
+            return Hits;
+        }, _ => {});
+
+        var Result = new List<Candidate>[Queries.Count];
+        Parallel.For(0, Queries.Count, Query =>
+        {
+            var Fingerprints = QueryFingerprints[Query].ToHashSet();
+            Result[Query] = Ranked[Query].OrderByDescending(Rank => Rank.Score).ThenBy(Rank => Entries[Rank.File].RelativePath, StringComparer.Ordinal)
+                .Take(MaxCandidates).Select(Rank => Locate(Path.Combine(RootDirectory, Entries[Rank.File].RelativePath), Queries[Query], Fingerprints))
+                .OrderByDescending(Candidate => Candidate.Score).ToList();
+        });
+        return Result;
+    }
+
+    /// <summary>
+    /// The tightest span no longer than twice the query with most of its fingerprints.
+    /// </summary>
+    private static Candidate Locate(string FilePath, string Query, HashSet<uint> QueryFingerprints)
+    {
+        string Text = File.ReadAllText(FilePath);
+        var Matches = GetFingerprints(Text).Where(Fingerprint => QueryFingerprints.Contains(Fingerprint.Hash)).ToList();
+
+        int Best = 0, BestCount = 0, BestSpan = int.MaxValue;
+        var Counts = new Dictionary<uint, int>();
+        for (int First = 0, Last = 0; Last < Matches.Count; ++Last)
+        {
+            Counts[Matches[Last].Hash] = Counts.GetValueOrDefault(Matches[Last].Hash) + 1;
+            for (; Matches[Last].Offset - Matches[First].Offset > Query.Length * 2; ++First)
+            {
+                if (--Counts[Matches[First].Hash] == 0) Counts.Remove(Matches[First].Hash);
+            }
+            // Drop leading duplicates so that the span is as tight as possible
+            while (Counts[Matches[First].Hash] > 1) --Counts[Matches[First++].Hash];
+
+            int Span = Matches[Last].Offset - Matches[First].Offset;
+            if (Counts.Count < BestCount || Counts.Count == BestCount && Span >= BestSpan) continue;
+            BestCount = Counts.Count;
+            BestSpan = Span;
+            Best = Matches[First].Offset;
+        }
+
+        int Line = 1;
+        for (int Offset = Text.IndexOf('\n'); Offset >= 0 && Offset < Best; Offset = Text.IndexOf('\n', Offset + 1)) ++Line;
+        return new Candidate(FilePath, Line, (float)BestCount / QueryFingerprints.Count);
+    }
+}
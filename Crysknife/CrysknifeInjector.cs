@@ -1,6 +1,11 @@
 // SPDX-FileCopyrightText: 2024 Yun Hsiao Wu <yunhsiaow@gmail.com>
 // SPDX-License-Identifier: MIT
 
+using System.Collections.Concurrent;
+using System.IO.Enumeration;
+using System.Text;
+using System.Text.RegularExpressions;
+
 namespace Crysknife;
 
 [Flags]
@@ -10,6 +15,7 @@ public enum JobType
     Generate = 0x1,
     Clear = 0x2,
     Apply = 0x4,
+    Verify = 0x8, // Check everything is up-to-date without writing anything
 }
 
 [Flags]
@@ -21,6 +27,13 @@ public enum JobOptions
     DryRun = 0x4,
     Verbose = 0x8,
     TreatPatchAsFile = 0x10,
+    Cascade = 0x20,
+    Refresh = 0x40,
+    TokenMatch = 0x80,
+    TokenDiff = 0x100,
+    Relocate = 0x200,
+    Report = 0x400,
+    RecordScopes = 0x800,
 }
 
 public class Injector
@@ -43,63 +56,45 @@ public class Injector
         }
     }
 
-    private readonly struct EngineVersion
-    {
-        private readonly int Major;
-        private readonly int Minor;
-
-        public static EngineVersion Create(string Value)
-        {
-            string[] Versions = Value.Split('_');
-            return new EngineVersion(int.Parse(Versions[0]), int.Parse(Versions[1]));
-        }
-
-        public static readonly EngineVersion Empty = new(0, 0);
-
-        private EngineVersion(int InMajor, int InMinor)
-        {
-            Major = InMajor;
-            Minor = InMinor;
-        }
-
-        public override string ToString()
-        {
-            return $"{Major}_{Minor}";
-        }
-
-        public int Distance(EngineVersion Other)
-        {
-            return Math.Abs(Major - Other.Major) * 100 + Math.Abs(Minor - Other.Minor);
-        }
-    }
-
     private readonly struct PatchDescription
     {
-        private readonly List<EngineVersion> Versions = new();
+        private readonly Dictionary<EngineVersion, PatchStorageMode> Versions = new();
+        public readonly List<EngineVersion> Conflicts = new(); // Versions stored in both modes
         public PatchDescription() {}
 
         public void Add(ParsedPath PatchPath)
         {
+            var Mode = PatchPath.Extensions.Contains(".delta") ? PatchStorageMode.Delta : PatchStorageMode.Full;
             foreach (var Extension in PatchPath.Extensions.Where(Extension => Extension.StartsWith(".v")))
             {
-                Versions.Add(EngineVersion.Create(Extension[2..]));
+                var Version = EngineVersion.Create(Extension[2..]);
+                if (Versions.TryGetValue(Version, out var Existing) && Existing != Mode) Conflicts.Add(Version);
+                Versions[Version] = Mode;
             }
         }
+        public IEnumerable<string> MatchFallbacks(EngineVersion TargetVersion)
+        {
+            string Nearest = Match(TargetVersion);
+            var Modes = Versions;
+            return Versions.Keys.OrderBy(Version => Version.Distance(TargetVersion))
+                .Select(Version => PatchStorage.MakeExtension(Version.ToString(), Modes[Version]))
+                .Where(Extension => Extension != Nearest);
+        }
         public string Match(EngineVersion TargetVersion)
         {
             int NearestDistance = int.MaxValue;
-            EngineVersion NearestVersion = Versions.Aggregate(EngineVersion.Empty, (Acc, Version) =>
+            EngineVersion NearestVersion = Versions.Keys.Aggregate(EngineVersion.Empty, (Acc, Version) =>
             {
                 int Distance = Version.Distance(TargetVersion);
                 if (Distance >= NearestDistance) return Acc;
                 NearestDistance = Distance;
                 return Version;
             });
-            return MakeExtension(NearestVersion);
+            return PatchStorage.MakeExtension(NearestVersion.ToString(), Versions.GetValueOrDefault(NearestVersion));
         }
         public static string MakeExtension(EngineVersion Version)
         {
-            return $".v{Version.ToString()}.patch";
+            return PatchStorage.MakeExtension(Version.ToString(), PatchStorageMode.Full);
         }
     }
 
@@ -141,31 +136,629 @@ public class Injector
 
     private readonly struct DMPContext
     {
+        private const string LegacyBaseHashKey = "hash"; // Written by earlier versions, ignored
+        private const string ScopeKeyPrefix = "scope.";
+        private const string ContextKey = "context";
+        private const string UniqueContextValue = "unique";
+
         private readonly DiffMatchPatch.diff_match_patch GenerationContext;
         private readonly DiffMatchPatch.diff_match_patch ApplyContext;
+        private readonly float MaxContentTolerance;
+        private readonly bool TokenMatch;
+        private readonly bool TokenDiff;
+        private readonly bool UniqueContext;
+        private readonly bool RecordScopes;
+
+        public DMPContext(short ContextLength, float ContentTolerance, float MaxContentTolerance, int LineTolerance, long DiffBudget,
+            bool TokenMatch, bool TokenDiff, bool RecordScopes)
+        {
+            UniqueContext = ContextLength == UniquePatchContext;
+            if (UniqueContext) ContextLength = MinUniqueContextLength;
+            this.MaxContentTolerance = MaxContentTolerance;
+            this.TokenMatch = TokenMatch;
+            this.TokenDiff = TokenDiff;
+            this.RecordScopes = RecordScopes;
+            // Work budget instead of wall-clock timeout, so that generated patches are reproducible on any machine
+            GenerationContext = new DiffMatchPatch.diff_match_patch { Patch_Margin = ContextLength, Diff_Timeout = 0, Diff_Budget = DiffBudget };
+            // Hard line window instead of character distance penalty, so that the search cost is bounded
+            ApplyContext = new DiffMatchPatch.diff_match_patch
+            {
+                Match_Threshold = ContentTolerance,
+                Match_Distance = int.MaxValue,
+                Match_LineDistance = LineTolerance == int.MaxValue ? -1 : LineTolerance,
+            };
+        }
 
-        public DMPContext(short ContextLength, float ContentTolerance, int LineTolerance)
+        public string Apply(string Content, List<DiffMatchPatch.Patch> Patches, out bool[] IsSuccess, out float[] Tolerances, string?[]? Scopes = null,
+            bool UniqueContext = false)
         {
-            GenerationContext = new DiffMatchPatch.diff_match_patch { Patch_Margin = ContextLength };
-            ApplyContext = new DiffMatchPatch.diff_match_patch { Match_Threshold = ContentTolerance, Match_Distance = LineTolerance };
+            return TokenMatch ? ApplyTokens(Content, Patches, out IsSuccess, out Tolerances, Scopes, UniqueContext)
+                : ApplyChars(Content, Patches, out IsSuccess, out Tolerances, Scopes, UniqueContext);
         }
 
-        public string Apply(string Content, List<DiffMatchPatch.Patch> Patches, out bool[] IsSuccess)
+        /// <summary>
+        /// Search windows of each split hunk inside patch_apply, restricted to the ranges of their recorded scopes in the content.
+        /// Hunks with unique contexts are cut into pieces of Match_MaxBits by patch_splitMax, losing the uniqueness,
+        /// so if the whole source of the hunk occurs exactly once, all its pieces are restricted to that occurrence instead.
+        /// </summary>
+        private int[]? GetWindows(string Content, List<DiffMatchPatch.Patch> Patches, string?[]? Scopes, bool UniqueContext)
         {
-            object[] Result = ApplyContext.patch_apply(Patches, Content);
+            if (!UniqueContext && (Scopes == null || Scopes.All(Scope => Scope == null))) return null;
+
+            var ContentScopes = Scopes != null ? CppScopes.Get(Content) : null;
+            var ContentIndex = UniqueContext ? new QGramIndex(Content) : null;
+            var Hunks = ApplyContext.patch_deepCopy(Patches);
+            int Padding = ApplyContext.patch_addPadding(Hunks).Length;
+            var Windows = new List<int>();
+            for (int Index = 0; Index < Hunks.Count; ++Index)
+            {
+                int Start = -1, End = -1;
+                bool Located = false;
+                if (ContentIndex != null)
+                {
+                    string Source = ApplyContext.diff_text1(Patches[Index].diffs);
+                    Start = ContentIndex.FindUnique(Source);
+                    End = Start + Source.Length;
+                    Located = Start >= 0;
+                    if (Located)
+                    {
+                        // Windows are in the padded content
+                        Start += Padding;
+                        End += Padding;
+                    }
+                }
+                if (!Located && Scopes != null && Index < Scopes.Length && Scopes[Index] is { } Scope)
+                {
+                    Located = ContentScopes!.Locate(Scope, Patches[Index].start2, out Start, out End);
+                }
+
+                // Hunks are split independently from each other
+                var Pieces = new List<DiffMatchPatch.Patch> { Hunks[Index] };
+                ApplyContext.patch_splitMax(Pieces);
+                foreach (var Piece in Pieces)
+                {
+                    // Contexts may reach outside of the scope
+                    Windows.Add(Located ? Math.Max(Start + ApplyContext.Patch_Margin - Piece.length1, 0) : -1);
+                    Windows.Add(Located ? End + ApplyContext.Patch_Margin + Piece.length1 : -1);
+                }
+            }
+            return Windows.ToArray();
+        }
+
+        private const int ParallelApplyThreshold = 16; // Hunks in one target
+
+        /// <summary>
+        /// Targets with many hunks locate the ones with bounded search windows concurrently first, with the same result.
+        /// </summary>
+        private object[] PatchApply(List<DiffMatchPatch.Patch> Patches, string Content, float[]? Thresholds, int[]? Windows)
+        {
+            return Patches.Count >= ParallelApplyThreshold ? ApplyContext.patch_applyParallel(Patches, Content, Thresholds, Windows)
+                : ApplyContext.patch_apply(Patches, Content, Thresholds, Windows);
+        }
+
+        private string ApplyChars(string Content, List<DiffMatchPatch.Patch> Patches, out bool[] IsSuccess, out float[] Tolerances, string?[]? Scopes = null,
+            bool UniqueContext = false)
+        {
+            var Windows = GetWindows(Content, Patches, Scopes, UniqueContext);
+            object[] Result = PatchApply(Patches, Content, null, Windows);
             IsSuccess = (bool[])Result[1];
+
+            // Hunks may have moved out of their scopes, search them everywhere again
+            if (Windows != null && IsSuccess.Select((Success, Index) => !Success && Windows[2 * Index] >= 0).Any(V => V))
+            {
+                var Unwindowed = (int[])Windows.Clone();
+                for (int Index = 0; Index < IsSuccess.Length; ++Index)
+                {
+                    if (!IsSuccess[Index]) Unwindowed[2 * Index] = Unwindowed[2 * Index + 1] = -1;
+                }
+                object[] Retried = PatchApply(Patches, Content, null, Unwindowed);
+                if (((bool[])Retried[1]).Count(V => V) > IsSuccess.Count(V => V))
+                {
+                    Result = Retried;
+                    IsSuccess = (bool[])Result[1];
+                    Windows = Unwindowed;
+                }
+            }
+            Tolerances = Enumerable.Repeat(ApplyContext.Match_Threshold, IsSuccess.Length).ToArray();
+
+            string Patched = (string)Result[0];
+            if (MaxContentTolerance > ApplyContext.Match_Threshold && IsSuccess.Contains(false))
+            {
+                Patched = ApplyEscalated(Content, Patches, Windows, Patched, ref IsSuccess, ref Tolerances);
+            }
+            return Patched;
+        }
+
+        public string Apply(string Content, List<DiffMatchPatch.Patch> Patches, bool TryExact, out bool[] IsSuccess, out float[] Tolerances,
+            string?[]? Scopes = null, bool UniqueContext = false)
+        {
+            string? Patched = TryExact ? ApplyExact(Content, Patches) : null;
+            if (Patched == null) return Apply(Content, Patches, out IsSuccess, out Tolerances, Scopes, UniqueContext);
+
+            IsSuccess = Enumerable.Repeat(true, Patches.Count).ToArray();
+            Tolerances = Enumerable.Repeat(0f, Patches.Count).ToArray();
+            return Patched;
+        }
+
+        public string Apply(string Content, string PatchPath, out bool[] IsSuccess, out float[] Tolerances)
+        {
+            var Metadata = new Dictionary<string, string>();
+            string Patch = PatchStorage.SplitMetadata(PatchStorage.Read(PatchPath), Metadata);
+            var Patches = ApplyContext.patch_fromText(Patch);
+            var Scopes = Enumerable.Range(0, Patches.Count)
+                .Select(Index => Metadata.TryGetValue(ScopeKeyPrefix + Index, out var Scope) ? Scope : null).ToArray();
+            bool UniqueContext = Metadata.TryGetValue(ContextKey, out var Context) && Context == UniqueContextValue;
+            return Apply(Content, Patches, true, out IsSuccess, out Tolerances, Scopes, UniqueContext);
+        }
+
+        public List<DiffMatchPatch.Patch> ReadPatches(string PatchPath)
+        {
+            return ApplyContext.patch_fromText(PatchStorage.SplitMetadata(PatchStorage.Read(PatchPath), new Dictionary<string, string>()));
+        }
+
+        /// <summary>
+        /// Hunks indexed the same way as the success flags of the specified count,
+        /// with the offset of each in the content before any hunk is applied.
+        /// </summary>
+        public List<DiffMatchPatch.Patch> GetHunks(List<DiffMatchPatch.Patch> Patches, int Count, out int[] Offsets)
+        {
+            int Padding = 0;
+            if (Patches.Count != Count)
+            {
+                // Flags are reported per split hunk
+                Patches = ApplyContext.patch_deepCopy(Patches);
+                Padding = ApplyContext.patch_addPadding(Patches).Length;
+                ApplyContext.patch_splitMax(Patches);
+            }
+
+            Offsets = new int[Patches.Count];
+            int Delta = 0; // Hunk offsets are relative to the content with all previous hunks applied
+            for (int Index = 0; Index < Patches.Count; ++Index)
+            {
+                Offsets[Index] = Math.Max(Patches[Index].start2 - Padding - Delta, 0);
+                Delta += Patches[Index].length2 - Patches[Index].length1;
+            }
+            return Patches;
+        }
+
+        public string GetHunkSource(DiffMatchPatch.Patch Hunk)
+        {
+            return ApplyContext.diff_text1(Hunk.diffs);
+        }
+
+        private const int MinTokenMatchLength = 4;
+
+        /// <summary>
+        /// Locate each hunk by its C++ tokens in the unmodified content, so that formatting differences don't matter,
+        /// then splice all located hunks in one pass. The rest fall back to character matching afterwards.
+        /// </summary>
+        private string ApplyTokens(string Content, List<DiffMatchPatch.Patch> Patches, out bool[] IsSuccess, out float[] Tolerances,
+            string?[]? Scopes, bool UniqueContext)
+        {
+            var Target = CppTokens.Get(Content);
+            var LineStarts = ApplyContext.Match_LineDistance >= 0 ? ApplyContext.match_lineStarts(Content) : null;
+            var Output = new StringBuilder(Content.Length);
+            var Edits = new List<(int Start, int End, string Text)>();
+            var Fallbacks = new List<(int Index, DiffMatchPatch.Patch Hunk)>();
+            IsSuccess = new bool[Patches.Count];
+            Tolerances = new float[Patches.Count];
+            int Cursor = 0, Delta = 0, Shift = 0;
+
+            for (int Index = 0; Index < Patches.Count; ++Index)
+            {
+                var Hunk = Patches[Index];
+                var Source = new CppTokens(ApplyContext.diff_text1(Hunk.diffs));
+                // Contexts are cut at arbitrary characters, so tokens on the edges may be partial
+                int First = Hunk.start2 == 0 ? 0 : 1;
+                int Count = Source.Count - First - 1;
+                int Expected = Hunk.start2 + Delta + (Count > 0 ? Source.Starts[First] : 0);
+                int From = 0, To = Target.Count;
+                if (Scopes != null && Index < Scopes.Length && Scopes[Index] is { } Scope &&
+                    CppScopes.Get(Content).Locate(Scope, Expected, out var ScopeStart, out var ScopeEnd))
+                {
+                    From = Math.Max(Target.FindToken(ScopeStart) - Count, 0);
+                    To = Math.Min(Target.FindToken(ScopeEnd) + Count, Target.Count);
+                }
+                if (LineStarts != null)
+                {
+                    ApplyContext.match_lineWindow(LineStarts, Expected, 0, out var LineStart, out var LineEnd);
+                    From = Math.Max(From, Target.FindToken(LineStart));
+                    To = Math.Min(To, Target.FindToken(LineEnd) + Count);
+                }
+                int Found = Count < MinTokenMatchLength ? -1 : Target.Match(Source, First, Count, Target.FindToken(Expected), From, To);
+
+                Edits.Clear();
+                int Offset = 0, Last = Cursor;
+                foreach (var Diff in Found < 0 ? Enumerable.Empty<DiffMatchPatch.Diff>() : Hunk.diffs)
+                {
+                    if (Diff.operation == DiffMatchPatch.Operation.EQUAL)
+                    {
+                        Offset += Diff.text.Length;
+                        continue;
+                    }
+
+                    int Start = CppTokens.MapOffset(Offset, Source, First, Count, Target, Found);
+                    if (Diff.operation == DiffMatchPatch.Operation.DELETE) Offset += Diff.text.Length;
+                    int End = Diff.operation == DiffMatchPatch.Operation.DELETE ? CppTokens.MapOffset(Offset, Source, First, Count, Target, Found) : Start;
+                    if (Start < Last || End < Start)
+                    {
+                        Edits.Clear();
+                        break;
+                    }
+                    Edits.Add((Start, End, Diff.operation == DiffMatchPatch.Operation.INSERT ? Diff.text : string.Empty));
+                    Last = End;
+                }
+
+                if (Edits.Count == 0)
+                {
+                    var Copy = ApplyContext.patch_deepCopy(new List<DiffMatchPatch.Patch> { Hunk })[0];
+                    Copy.start1 += Shift;
+                    Copy.start2 += Shift;
+                    Fallbacks.Add((Index, Copy));
+                    continue;
+                }
+
+                foreach (var Edit in Edits)
+                {
+                    Output.Append(Content, Cursor, Edit.Start - Cursor).Append(Edit.Text);
+                    Shift += Edit.Text.Length - (Edit.End - Edit.Start);
+                    Cursor = Edit.End;
+                }
+                Delta = Target.Starts[Found] - Source.Starts[First] - Hunk.start2;
+                IsSuccess[Index] = true;
+            }
+            string Patched = Output.Append(Content, Cursor, Content.Length - Cursor).ToString();
+
+            foreach (var Fallback in Fallbacks)
+            {
+                Patched = ApplyChars(Patched, new List<DiffMatchPatch.Patch> { Fallback.Hunk }, out var HunkSuccess, out var HunkTolerances,
+                    Scopes != null && Fallback.Index < Scopes.Length ? new[] { Scopes[Fallback.Index] } : null, UniqueContext);
+                IsSuccess[Fallback.Index] = HunkSuccess.All(V => V);
+                Tolerances[Fallback.Index] = HunkTolerances.Max();
+            }
+            return Patched;
+        }
+
+        private const float ContentToleranceStep = 0.05f;
+
+        /// <summary>
+        /// Search the lowest content tolerance each failed hunk needs in parallel, against the result with all other hunks applied,
+        /// then apply again with only those hunks loosened. Kept only if it is actually better.
+        /// </summary>
+        private string ApplyEscalated(string Content, List<DiffMatchPatch.Patch> Patches, int[]? Windows, string Patched,
+            ref bool[] IsSuccess, ref float[] Tolerances)
+        {
+            // Same hunk split as inside patch_apply
+            var Hunks = ApplyContext.patch_deepCopy(Patches);
+            string Padding = ApplyContext.patch_addPadding(Hunks);
+            ApplyContext.patch_splitMax(Hunks);
+            string Text = Padding + Patched + Padding;
+            var LineStarts = ApplyContext.Match_LineDistance >= 0 ? ApplyContext.match_lineStarts(Text) : null;
+
+            var Context = ApplyContext;
+            float BaseTolerance = ApplyContext.Match_Threshold, MaxTolerance = MaxContentTolerance;
+            var Escalated = (float[])Tolerances.Clone();
+            var Failed = IsSuccess.Select((Success, Index) => Success ? -1 : Index).Where(Index => Index >= 0).ToList();
+            Parallel.ForEach(Failed, Index =>
+            {
+                string Source = Context.diff_text1(Hunks[Index].diffs);
+                int Start = 0, End = Text.Length;
+                if (LineStarts != null) Context.match_lineWindow(LineStarts, Hunks[Index].start2, Source.Length, out Start, out End);
+                string Window = Text[Start..Math.Min(End, Text.Length)];
+                for (int Step = 1; BaseTolerance + Step * ContentToleranceStep <= MaxTolerance + 1e-4f; ++Step)
+                {
+                    float Tolerance = Math.Min(BaseTolerance + Step * ContentToleranceStep, MaxTolerance);
+                    if (Context.patch_locate(Window, Source, Hunks[Index].start2 - Start, Tolerance, out _) == -1) continue;
+                    Escalated[Index] = Tolerance;
+                    break;
+                }
+            });
+
+            object[] Result = PatchApply(Patches, Content, Escalated, Windows);
+            var EscalatedSuccess = (bool[])Result[1];
+            if (EscalatedSuccess.Count(V => V) <= IsSuccess.Count(V => V)) return Patched;
+
+            IsSuccess = EscalatedSuccess;
+            Tolerances = Escalated;
             return (string)Result[0];
         }
 
-        public string Apply(string Content, string PatchPath, out bool[] IsSuccess)
+        /// <summary>
+        /// Whether the patch splices in at its recorded offsets exactly, producing the specified result.
+        /// </summary>
+        public bool IsExact(string Content, string PatchPath, string Patched)
         {
-            return Apply(Content, ApplyContext.patch_fromText(File.ReadAllText(PatchPath)), out IsSuccess);
+            return ApplyExact(Content, ReadPatches(PatchPath)) == Patched;
+        }
+
+        /// <summary>
+        /// Whether the two patches are the same, regardless of metadata written by earlier versions.
+        /// </summary>
+        public static bool IsSamePatch(string Patch, string Other)
+        {
+            var Metadata = new Dictionary<string, string>();
+            var OtherMetadata = new Dictionary<string, string>();
+            string Body = PatchStorage.SplitMetadata(Patch, Metadata);
+            string OtherBody = PatchStorage.SplitMetadata(Other, OtherMetadata);
+            Metadata.Remove(LegacyBaseHashKey);
+            OtherMetadata.Remove(LegacyBaseHashKey);
+            return Body == OtherBody && Metadata.Count == OtherMetadata.Count &&
+                Metadata.All(Pair => OtherMetadata.TryGetValue(Pair.Key, out var Value) && Value == Pair.Value);
+        }
+
+        /// <summary>
+        /// Splice all hunks in at their recorded offsets without any matching, if the source of every hunk is found exactly there,
+        /// e.g. when the content is identical to the one patches are generated from.
+        /// </summary>
+        private string? ApplyExact(string Content, List<DiffMatchPatch.Patch> Patches)
+        {
+            var Output = new StringBuilder(Content.Length);
+            int Cursor = 0;
+            int Delta = 0; // Hunk offsets are relative to the content with all previous hunks applied
+
+            foreach (var Patch in Patches)
+            {
+                string Source = ApplyContext.diff_text1(Patch.diffs);
+                int Start = Patch.start2 - Delta;
+                if (Start < Cursor || Start + Source.Length > Content.Length ||
+                    string.CompareOrdinal(Content, Start, Source, 0, Source.Length) != 0) return null;
+
+                string Target = ApplyContext.diff_text2(Patch.diffs);
+                Output.Append(Content, Cursor, Start - Cursor).Append(Target);
+                Cursor = Start + Source.Length;
+                Delta += Target.Length - Source.Length;
+            }
+
+            return Output.Append(Content, Cursor, Content.Length - Cursor).ToString();
+        }
+
+        private const int ParallelDiffThreshold = 1 << 19; // Characters of both sides combined
+        private const int MinChunkLength = 1 << 15;
+
+        private static int[] GetLineStarts(string Text)
+        {
+            var Starts = new List<int> { 0 };
+            for (int Index = Text.IndexOf('\n'); Index >= 0 && Index + 1 < Text.Length; Index = Text.IndexOf('\n', Index + 1))
+            {
+                Starts.Add(Index + 1);
+            }
+            Starts.Add(Text.Length); // Sentinel
+            return Starts.ToArray();
+        }
+
+        /// <summary>
+        /// 1-based line number of each offset in the text.
+        /// </summary>
+        public static int[] GetLineNumbers(string Text, int[] Offsets)
+        {
+            var LineStarts = GetLineStarts(Text);
+            return Offsets.Select(Offset =>
+            {
+                int Line = Array.BinarySearch(LineStarts, Math.Min(Offset, Text.Length));
+                return (Line < 0 ? ~Line - 1 : Line) + 1;
+            }).ToArray();
         }
 
-        public List<DiffMatchPatch.Diff> GenerateDiffs(string Source, string Target)
+        /// <summary>
+        /// Patience-style anchors: non-blank lines appearing exactly once on both sides,
+        /// reduced to the longest subsequence increasing on both sides.
+        /// </summary>
+        private static List<(int Source, int Target)> FindAnchors(string Source, int[] SourceLines, string Target, int[] TargetLines)
         {
-            var Diffs = GenerationContext.diff_main(Source, Target);
+            var Occurrences = new Dictionary<ReadOnlyMemory<char>, (int Source, int Target, int SourceCount, int TargetCount)>(OrdinalMemoryComparer.Instance);
+            for (int Line = 0; Line < SourceLines.Length - 1; ++Line)
+            {
+                var Key = Source.AsMemory(SourceLines[Line], SourceLines[Line + 1] - SourceLines[Line]);
+                if (Key.Span.IsWhiteSpace()) continue;
+                Occurrences.TryGetValue(Key, out var Value);
+                Occurrences[Key] = (Line, -1, Value.SourceCount + 1, 0);
+            }
+            for (int Line = 0; Line < TargetLines.Length - 1; ++Line)
+            {
+                var Key = Target.AsMemory(TargetLines[Line], TargetLines[Line + 1] - TargetLines[Line]);
+                if (!Occurrences.TryGetValue(Key, out var Value)) continue;
+                Occurrences[Key] = (Value.Source, Line, Value.SourceCount, Value.TargetCount + 1);
+            }
+
+            var Candidates = Occurrences.Values.Where(Value => Value.SourceCount == 1 && Value.TargetCount == 1)
+                .Select(Value => (Value.Source, Value.Target)).OrderBy(Value => Value.Source).ToList();
+
+            // Longest increasing subsequence over target lines
+            var Tails = new List<int>(); // Candidate indices ending the best subsequence of each length
+            var Previous = new int[Candidates.Count];
+            for (int Index = 0; Index < Candidates.Count; ++Index)
+            {
+                int Low = 0, High = Tails.Count;
+                while (Low < High)
+                {
+                    int Mid = (Low + High) / 2;
+                    if (Candidates[Tails[Mid]].Target < Candidates[Index].Target) Low = Mid + 1;
+                    else High = Mid;
+                }
+                Previous[Index] = Low > 0 ? Tails[Low - 1] : -1;
+                if (Low == Tails.Count) Tails.Add(Index);
+                else Tails[Low] = Index;
+            }
+
+            var Anchors = new List<(int Source, int Target)>(Tails.Count);
+            for (int Index = Tails.Count > 0 ? Tails[^1] : -1; Index >= 0; Index = Previous[Index]) Anchors.Add(Candidates[Index]);
+            Anchors.Reverse();
+            return Anchors;
+        }
+
+        /// <summary>
+        /// Split huge inputs at anchor lines into independent chunks, diff them in parallel and stitch the results.
+        /// </summary>
+        private List<DiffMatchPatch.Diff> DiffInParallel(string Source, string Target, out DiffMatchPatch.DiffLimit Usage)
+        {
+            var SourceLines = GetLineStarts(Source);
+            var TargetLines = GetLineStarts(Target);
+            var Anchors = FindAnchors(Source, SourceLines, Target, TargetLines);
+
+            // Only cut at anchors when the pending chunk is large enough to be worth a separate task
+            var Cuts = new List<(int Source, int Target)>();
+            int SourceCursor = 0, TargetCursor = 0;
+            foreach (var Anchor in Anchors)
+            {
+                int Pending = SourceLines[Anchor.Source] - SourceCursor + TargetLines[Anchor.Target] - TargetCursor;
+                if (Pending < MinChunkLength) continue;
+                Cuts.Add(Anchor);
+                SourceCursor = SourceLines[Anchor.Source + 1];
+                TargetCursor = TargetLines[Anchor.Target + 1];
+            }
+            Usage = GenerationContext.diff_newLimit();
+            if (Cuts.Count == 0) return DiffRange(GenerationContext, TokenDiff, Source, Target, Usage);
+
+            // Each chunk gets its share of the budget by length, independent of scheduling
+            var Chunks = new List<DiffMatchPatch.Diff>[Cuts.Count + 1];
+            var Limits = new DiffMatchPatch.DiffLimit[Chunks.Length];
+            var Context = GenerationContext;
+            bool ByTokens = TokenDiff;
+            long TotalLength = Source.Length + Target.Length;
+            Parallel.For(0, Chunks.Length, Index =>
+            {
+                int SourceStart = Index > 0 ? SourceLines[Cuts[Index - 1].Source + 1] : 0;
+                int TargetStart = Index > 0 ? TargetLines[Cuts[Index - 1].Target + 1] : 0;
+                int SourceEnd = Index < Cuts.Count ? SourceLines[Cuts[Index].Source] : Source.Length;
+                int TargetEnd = Index < Cuts.Count ? TargetLines[Cuts[Index].Target] : Target.Length;
+                // In decimal since the product may overflow a long with large budgets, while the quotient never exceeds the budget
+                decimal Length = SourceEnd - SourceStart + TargetEnd - TargetStart;
+                long Share = Context.Diff_Budget > 0 ? Math.Max((long)(Context.Diff_Budget * Length / TotalLength), 1) : 0;
+                Limits[Index] = new DiffMatchPatch.DiffLimit(DateTime.MaxValue, Share);
+                Chunks[Index] = DiffRange(Context, ByTokens, Source[SourceStart..SourceEnd], Target[TargetStart..TargetEnd], Limits[Index]);
+            });
+            Usage.used = Limits.Sum(Limit => Limit.used);
+            Usage.exhausted = Limits.Any(Limit => Limit.exhausted);
+
+            var Diffs = new List<DiffMatchPatch.Diff>();
+            for (int Index = 0; Index < Chunks.Length; ++Index)
+            {
+                Diffs.AddRange(Chunks[Index]);
+                if (Index == Cuts.Count) break;
+                int Line = Cuts[Index].Source;
+                Diffs.Add(new DiffMatchPatch.Diff(DiffMatchPatch.Operation.EQUAL, Source[SourceLines[Line]..SourceLines[Line + 1]]));
+            }
+            if (TokenDiff) MergeAdjacent(Diffs); // Seams are always on line boundaries, don't factor out anything across tokens
+            else GenerationContext.diff_cleanupMerge(Diffs); // Fix up the seams
+            return Diffs;
+        }
+
+        private static void MergeAdjacent(List<DiffMatchPatch.Diff> Diffs)
+        {
+            int Count = 0;
+            foreach (var Diff in Diffs)
+            {
+                if (Diff.text.Length == 0) continue;
+                if (Count > 0 && Diffs[Count - 1].operation == Diff.operation) Diffs[Count - 1].text += Diff.text;
+                else Diffs[Count++] = Diff;
+            }
+            Diffs.RemoveRange(Count, Diffs.Count - Count);
+        }
+
+        private static char ToUnitCode(int Index)
+        {
+            return (char)(Index < 0xD800 ? Index : Index + 0x800); // Skip the surrogates
+        }
+
+        private const int MaxUnitCount = char.MaxValue + 1 - 0x800;
+
+        private static readonly Regex CommentUnitRE = new (@"\w+|\s+|.", RegexOptions.Compiled | RegexOptions.Singleline);
+
+        private static IEnumerable<(int Start, int End)> GetUnits(string Text, int Start, int End)
+        {
+            // Comments may be (un)commented out code, diff them by words instead
+            if (End - Start > 2 && Text[Start] == '/' && Text[Start + 1] is '/' or '*')
+            {
+                return CommentUnitRE.Matches(Text[Start..End]).Select(Matched => (Start + Matched.Index, Start + Matched.Index + Matched.Length));
+            }
+            return new[] { (Start: Start, End: End) };
+        }
+
+        /// <summary>
+        /// Encode each C++ token or whitespace run between them as one character, returns false if there are too many distinct ones.
+        /// </summary>
+        private static bool EncodeTokens(string Text, Dictionary<string, char> Codes, List<string> Units, StringBuilder Output)
+        {
+            var Tokens = new CppTokens(Text);
+            int Cursor = 0;
+            for (int Index = 0; Index <= Tokens.Count; ++Index)
+            {
+                int Start = Index < Tokens.Count ? Tokens.Starts[Index] : Text.Length;
+                int End = Index < Tokens.Count ? Tokens.Ends[Index] : Text.Length;
+                foreach (var Range in GetUnits(Text, Start, End).Prepend((Start: Cursor, End: Start)))
+                {
+                    if (Range.Start == Range.End) continue;
+                    string Unit = Text[Range.Start..Range.End];
+                    if (!Codes.TryGetValue(Unit, out var Code))
+                    {
+                        if (Units.Count == MaxUnitCount) return false;
+                        Code = ToUnitCode(Units.Count);
+                        Codes.Add(Unit, Code);
+                        Units.Add(Unit);
+                    }
+                    Output.Append(Code);
+                }
+                Cursor = End;
+            }
+            return true;
+        }
+
+        /// <summary>
+        /// Diff by tokens so that no edit boundary falls inside any token, cleanups are done on token level as well.
+        /// </summary>
+        private static List<DiffMatchPatch.Diff> DiffTokens(DiffMatchPatch.diff_match_patch Context, string Source, string Target,
+            DiffMatchPatch.DiffLimit Limit)
+        {
+            var Codes = new Dictionary<string, char>();
+            var Units = new List<string>();
+            StringBuilder EncodedSource = new(), EncodedTarget = new();
+            if (!EncodeTokens(Source, Codes, Units, EncodedSource) || !EncodeTokens(Target, Codes, Units, EncodedTarget))
+            {
+                var Fallback = Context.diff_main(Source, Target, true, Limit);
+                if (Fallback.Count > 2)
+                {
+                    Context.diff_cleanupSemantic(Fallback);
+                    Context.diff_cleanupEfficiency(Fallback);
+                }
+                return Fallback;
+            }
+
+            var Diffs = Context.diff_main(EncodedSource.ToString(), EncodedTarget.ToString(), false, Limit);
             if (Diffs.Count > 2)
+            {
+                Context.diff_cleanupSemantic(Diffs);
+                Context.diff_cleanupEfficiency(Diffs);
+            }
+
+            var Decoded = new StringBuilder();
+            foreach (var Diff in Diffs)
+            {
+                Decoded.Clear();
+                foreach (char Code in Diff.text) Decoded.Append(Units[Code < 0xD800 ? Code : Code - 0x800]);
+                Diff.text = Decoded.ToString();
+            }
+            return Diffs;
+        }
+
+        private static List<DiffMatchPatch.Diff> DiffRange(DiffMatchPatch.diff_match_patch Context, bool ByTokens, string Source, string Target,
+            DiffMatchPatch.DiffLimit Limit)
+        {
+            return ByTokens ? DiffTokens(Context, Source, Target, Limit) : Context.diff_main(Source, Target, true, Limit);
+        }
+
+        public List<DiffMatchPatch.Diff> GenerateDiffs(string Source, string Target, out DiffMatchPatch.DiffLimit Usage)
+        {
+            List<DiffMatchPatch.Diff> Diffs;
+            if (Source.Length + Target.Length > ParallelDiffThreshold)
+            {
+                Diffs = DiffInParallel(Source, Target, out Usage);
+            }
+            else
+            {
+                Usage = GenerationContext.diff_newLimit();
+                Diffs = DiffRange(GenerationContext, TokenDiff, Source, Target, Usage);
+            }
+            if (!TokenDiff && Diffs.Count > 2)
             {
                 GenerationContext.diff_cleanupSemantic(Diffs);
                 GenerationContext.diff_cleanupEfficiency(Diffs);
@@ -175,124 +768,606 @@ public class Injector
 
         public List<DiffMatchPatch.Patch> GeneratePatches(string Source, List<DiffMatchPatch.Diff> Diffs)
         {
-            return GenerationContext.patch_make(Source, Diffs);
+            return UniqueContext ? MakeUniquePatches(Source, Diffs) : GenerationContext.patch_make(Source, Diffs);
+        }
+
+        private const int MinUniqueContextLength = 16;
+        private const int MaxUniqueContextLength = 1024;
+
+        /// <summary>
+        /// Grow the context of each change only until the hunk source is unique in the whole source,
+        /// then merge all the hunks with overlapping contexts.
+        /// </summary>
+        private static List<DiffMatchPatch.Patch> MakeUniquePatches(string Source, List<DiffMatchPatch.Diff> Diffs)
+        {
+            // Source & target offsets of each diff, plus one sentinel at the end
+            var SourceOffsets = new int[Diffs.Count + 1];
+            var TargetOffsets = new int[Diffs.Count + 1];
+            for (int Index = 0; Index < Diffs.Count; ++Index)
+            {
+                var Diff = Diffs[Index];
+                SourceOffsets[Index + 1] = SourceOffsets[Index] + (Diff.operation != DiffMatchPatch.Operation.INSERT ? Diff.text.Length : 0);
+                TargetOffsets[Index + 1] = TargetOffsets[Index] + (Diff.operation != DiffMatchPatch.Operation.DELETE ? Diff.text.Length : 0);
+            }
+
+            // Changes as diff index ranges with their context ranges in the source
+            var Changes = new List<(int First, int Last, int Start, int End)>();
+            QGramIndex? SourceIndex = null;
+            for (int First = 0; First < Diffs.Count; ++First)
+            {
+                if (Diffs[First].operation == DiffMatchPatch.Operation.EQUAL) continue;
+                int Last = First;
+                while (Last + 1 < Diffs.Count && Diffs[Last + 1].operation != DiffMatchPatch.Operation.EQUAL) ++Last;
+
+                int ChangeStart = SourceOffsets[First], ChangeEnd = SourceOffsets[Last + 1];
+                int Start, End;
+                for (int Length = MinUniqueContextLength;; Length += MinUniqueContextLength)
+                {
+                    Start = Math.Max(ChangeStart - Length, 0);
+                    End = Math.Min(ChangeEnd + Length, Source.Length);
+                    if (Length >= MaxUniqueContextLength || (Start == 0 && End == Source.Length)) break;
+                    SourceIndex ??= new QGramIndex(Source);
+                    if (SourceIndex.Count(Source[Start..End], 2) <= 1) break;
+                }
+
+                if (Changes.Count > 0 && Changes[^1].End >= Start)
+                {
+                    Changes[^1] = (Changes[^1].First, Last, Changes[^1].Start, End);
+                }
+                else
+                {
+                    Changes.Add((First, Last, Start, End));
+                }
+                First = Last;
+            }
+
+            var Patches = new List<DiffMatchPatch.Patch>(Changes.Count);
+            foreach (var Change in Changes)
+            {
+                var Patch = new DiffMatchPatch.Patch();
+                int Prefix = SourceOffsets[Change.First] - Change.Start;
+                int Suffix = Change.End - SourceOffsets[Change.Last + 1];
+                if (Prefix > 0) Patch.diffs.Add(new DiffMatchPatch.Diff(DiffMatchPatch.Operation.EQUAL, Source.Substring(Change.Start, Prefix)));
+                for (int Diff = Change.First; Diff <= Change.Last; ++Diff)
+                {
+                    Patch.diffs.Add(new DiffMatchPatch.Diff(Diffs[Diff].operation, Diffs[Diff].text));
+                }
+                if (Suffix > 0) Patch.diffs.Add(new DiffMatchPatch.Diff(DiffMatchPatch.Operation.EQUAL, Source.Substring(SourceOffsets[Change.Last + 1], Suffix)));
+
+                // Both relative to the content with all previous hunks applied, same as patch_make
+                Patch.start2 = TargetOffsets[Change.First] - Prefix;
+                Patch.start1 = Patch.start2;
+                Patch.length1 = Change.End - Change.Start;
+                Patch.length2 = TargetOffsets[Change.Last + 1] - TargetOffsets[Change.First] + Prefix + Suffix;
+                Patches.Add(Patch);
+            }
+            return Patches;
+        }
+
+        public string Generate(string Source, List<DiffMatchPatch.Patch> Patches)
+        {
+            var Metadata = new Dictionary<string, string>();
+            if (UniqueContext) Metadata[ContextKey] = UniqueContextValue;
+            if (!RecordScopes) return PatchStorage.JoinMetadata(Metadata, GenerationContext.patch_toText(Patches));
+
+            // Enclosing scope of the first change in each hunk, opt-in since older versions can't parse them,
+            // and renaming or nesting the scope upstream changes the patch as well
+            var SourceScopes = CppScopes.Get(Source);
+            int Delta = 0; // Hunk offsets are relative to the content with all previous hunks applied
+            for (int Index = 0; Index < Patches.Count; ++Index)
+            {
+                var Patch = Patches[Index];
+                int Offset = Patch.start2 - Delta + (Patch.diffs.Count > 0 && Patch.diffs[0].operation == DiffMatchPatch.Operation.EQUAL ? Patch.diffs[0].text.Length : 0);
+                if (SourceScopes.Find(Offset) is { } Scope) Metadata[ScopeKeyPrefix + Index] = Scope;
+                Delta += Patch.length2 - Patch.length1;
+            }
+
+            return PatchStorage.JoinMetadata(Metadata, GenerationContext.patch_toText(Patches));
+        }
+    }
+
+    private readonly struct ApplyResult
+    {
+        public readonly string PatchPath;
+        public readonly string Patched;
+        public readonly bool[] IsSuccess;
+        public readonly float[] Tolerances; // Content tolerance each hunk needed
+
+        public ApplyResult(string PatchPath, string Patched, bool[] IsSuccess, float[] Tolerances)
+        {
+            this.PatchPath = PatchPath;
+            this.Patched = Patched;
+            this.IsSuccess = IsSuccess;
+            this.Tolerances = Tolerances;
+        }
+
+        public int SuccessCount => IsSuccess.Count(V => V);
+
+        public bool IsFullySuccessful => SuccessCount == IsSuccess.Length;
+
+        public bool IsBetterThan(ApplyResult Other)
+        {
+            if (IsFullySuccessful != Other.IsFullySuccessful) return IsFullySuccessful;
+            // Different versions may have different hunk counts, compare the success ratio instead
+            return SuccessCount * Other.IsSuccess.Length > Other.SuccessCount * IsSuccess.Length;
+        }
+    }
+
+    /// <summary>
+    /// Apply from patch files with cascade fallbacks if any, results are reused from the cache if all inputs are the same.
+    /// </summary>
+    private ApplyResult ApplyPatchFile(string ClearedTarget, string PatchPath, IReadOnlyList<string>? FallbackPatchPaths, bool UseCache = true)
+    {
+        string? Key = null;
+        if (ResultCache != null && UseCache)
+        {
+            var PatchPaths = FallbackPatchPaths != null ? FallbackPatchPaths.Prepend(PatchPath) : new[] { PatchPath };
+            Key = ApplyCache.MakeKey(PatchPaths.Select(Candidate => Utils.GetContentHash(PatchStorage.Read(Candidate)))
+                .Prepend($"{MatchContentTolerance}|{MaxMatchContentTolerance}|{MatchLineTolerance}|{Options.HasFlag(JobOptions.TokenMatch)}")
+                .Prepend(Utils.GetContentHash(ClearedTarget)));
+
+            if (ResultCache.TryGet(Key, out var PatchName, out var Cached, out var CachedSuccess, out var CachedTolerances))
+            {
+                // Patch files are named after their engine versions, which are unique among the candidates
+                string CachedPatchPath = PatchPaths.FirstOrDefault(Candidate => Path.GetFileName(Candidate) == PatchName) ?? PatchPath;
+                if (Options.HasFlag(JobOptions.Verbose))
+                {
+                    Console.ForegroundColor = ConsoleColor.Gray;
+                    Console.WriteLine("Apply cache hit: " + CachedPatchPath);
+                }
+                return new ApplyResult(CachedPatchPath, Cached, CachedSuccess, CachedTolerances);
+            }
+        }
+
+        string Patched = PatchTool.Apply(ClearedTarget, PatchPath, out var IsSuccess, out var Tolerances);
+        var Result = new ApplyResult(PatchPath, Patched, IsSuccess, Tolerances);
+        if (FallbackPatchPaths != null) Result = ApplyCascade(ClearedTarget, Result, FallbackPatchPaths);
+
+        if (Key != null) ResultCache!.Put(Key, Path.GetFileName(Result.PatchPath), Result.Patched, Result.IsSuccess, Result.Tolerances);
+        return Result;
+    }
+
+    private ApplyResult ApplyCascade(string ClearedTarget, ApplyResult Nearest, IReadOnlyList<string> FallbackPatchPaths)
+    {
+        if (Nearest.IsFullySuccessful || FallbackPatchPaths.Count == 0) return Nearest;
+
+        // Try all the other versions concurrently in memory, in the order of engine version distance
+        var Results = new ApplyResult[FallbackPatchPaths.Count];
+        Parallel.For(0, FallbackPatchPaths.Count, Index =>
+        {
+            string Patched = PatchTool.Apply(ClearedTarget, FallbackPatchPaths[Index], out var IsSuccess, out var Tolerances);
+            Results[Index] = new ApplyResult(FallbackPatchPaths[Index], Patched, IsSuccess, Tolerances);
+        });
+
+        if (Options.HasFlag(JobOptions.Verbose))
+        {
+            foreach (var Result in Results.Prepend(Nearest))
+            {
+                Console.ForegroundColor = ConsoleColor.Gray;
+                Console.WriteLine("Cascade: {0} ({1}/{2})", Result.PatchPath, Result.SuccessCount, Result.IsSuccess.Length);
+            }
+        }
+
+        // Ties are resolved in favor of the nearer version
+        return Results.Aggregate(Nearest, (Best, Result) => Result.IsBetterThan(Best) ? Result : Best);
+    }
+
+    private void ReportDiffUsage(string TargetPath, DiffMatchPatch.DiffLimit Usage)
+    {
+        if (Usage.exhausted)
+        {
+            Console.ForegroundColor = ConsoleColor.Yellow;
+            Console.WriteLine("Diff budget exhausted ({0} units), patch may be suboptimal: {1}", Usage.used, TargetPath);
+        }
+        else if (Options.HasFlag(JobOptions.Verbose))
+        {
+            Console.ForegroundColor = ConsoleColor.Gray;
+            Console.WriteLine("Diff budget: {0}/{1} units for {2}", Usage.used, Usage.budget > 0 ? Usage.budget : "unlimited", TargetPath);
+        }
+    }
+
+    private const int MaxConcurrentRetries = 3;
+
+    /// <summary>
+    /// All reads are lock-free, only the final write locks the target and verifies nobody else changed it in between.
+    /// </summary>
+    private bool WriteTarget(string TargetPath, string Expected, string Content, int Attempt)
+    {
+        if (Utils.WriteIfUnchanged(TargetPath, Expected, Content, () => Journal.Record(TargetPath))) return true;
+
+        if (Attempt >= MaxConcurrentRetries)
+        {
+            Console.ForegroundColor = ConsoleColor.Red;
+            Console.Error.WriteLine("Error: '{0}' keeps being modified by other instances, skipped", TargetPath);
+        }
+        else
+        {
+            Console.ForegroundColor = ConsoleColor.Yellow;
+            Console.WriteLine("Target modified by another instance, reprocessing: " + TargetPath);
+        }
+        return false;
+    }
+
+    private void ProcessPatch(JobType Job, string PatchPath, string TargetPath, IReadOnlyList<string>? FallbackPatchPaths = null, int Attempt = 0)
+    {
+        string TargetContent = File.ReadAllText(TargetPath);
+        string ClearedTarget = InjectionRE.Unpatch(TargetContent);
+        List<DiffMatchPatch.Patch>? Patches = null;
+
+        if (Job.HasFlag(JobType.Generate))
+        {
+            var Diffs = PatchTool.GenerateDiffs(ClearedTarget, TargetContent, out var Usage);
+            ReportDiffUsage(TargetPath, Usage);
+            Patches = PatchTool.GeneratePatches(ClearedTarget, Diffs);
+
+            if (Patches.Count == 0)
+            {
+                if (!AutoClearConfirm.HasFlag(ConfirmResult.ForAll))
+                {
+                    AutoClearConfirm = PromptToConfirm($"Couldn't find any patch from '{TargetPath}', remove?");
+                }
+                if (AutoClearConfirm.HasFlag(ConfirmResult.Yes))
+                {
+                    RemovePatchFile(TargetPath);
+                    return;
+                }
+            }
+
+            string Patch = PatchTool.Generate(ClearedTarget, Patches);
+            if (!File.Exists(PatchPath) || !DMPContext.IsSamePatch(PatchStorage.Read(PatchPath), Patch))
+            {
+                PatchStorage.Write(PatchPath, Patch);
+                Console.ForegroundColor = ConsoleColor.Green;
+                Console.WriteLine("Patch updated: " + TargetPath);
+                Report.Record(JobStatus.Generated, TargetPath);
+            }
+            RecordBaseHash(PatchPath, ClearedTarget);
+        }
+
+        if (Job.HasFlag(JobType.Clear) && ClearedTarget.Length != TargetContent.Length)
+        {
+            if (!WriteTarget(TargetPath, TargetContent, ClearedTarget, Attempt))
+            {
+                if (Attempt < MaxConcurrentRetries) ProcessPatch(Job, PatchPath, TargetPath, FallbackPatchPaths, Attempt + 1);
+                return;
+            }
+            Console.ForegroundColor = ConsoleColor.Yellow;
+            Console.WriteLine("Patch removed from: " + TargetPath);
+            Report.Record(JobStatus.Cleared, TargetPath);
+            TargetContent = ClearedTarget;
         }
 
-        public string Generate(List<DiffMatchPatch.Patch> Patches)
+        if (Job.HasFlag(JobType.Apply))
         {
-            return GenerationContext.patch_toText(Patches);
+            ApplyResult Result;
+            if (Patches != null)
+            {
+                string Patched = PatchTool.Apply(ClearedTarget, Patches, true, out var IsSuccess, out var Tolerances);
+                Result = new ApplyResult(PatchPath, Patched, IsSuccess, Tolerances);
+            }
+            else Result = ApplyPatchFile(ClearedTarget, PatchPath, FallbackPatchPaths);
+            WriteConflictReport(TargetPath, ClearedTarget, Result, PatchPath, Patches);
+            bool ShouldRefresh = Result.IsFullySuccessful && Patches == null && Options.HasFlag(JobOptions.Refresh);
+            if (Result.Patched == TargetContent)
+            {
+                // Already applied, which is the usual case on re-runs
+                if (ShouldRefresh) RefreshPatch(PatchPath, ClearedTarget, Result.Patched);
+                return;
+            }
+
+            if (TargetContent.Length != ClearedTarget.Length)
+            {
+                // Apply op is potentially dangerous: Confirm before overriding any new contents.
+                if (!OverrideConfirm.HasFlag(ConfirmResult.ForAll))
+                {
+                    OverrideConfirm = PromptToConfirm($"Override already patched file {TargetPath}?");
+                }
+                if (OverrideConfirm.HasFlag(ConfirmResult.No)) return;
+            }
+
+            if (!WriteTarget(TargetPath, TargetContent, Result.Patched, Attempt))
+            {
+                if (Attempt < MaxConcurrentRetries) ProcessPatch(Job, PatchPath, TargetPath, FallbackPatchPaths, Attempt + 1);
+                return;
+            }
+
+            for (int Index = 0; Index < Result.IsSuccess.Length; ++Index)
+            {
+                if (!Result.IsSuccess[Index] || Result.Tolerances[Index] <= MatchContentTolerance) continue;
+                Console.ForegroundColor = ConsoleColor.Yellow;
+                Console.WriteLine("Hunk {0} matched at content tolerance {1:0.##}, please double check: {2}", Index + 1, Result.Tolerances[Index], TargetPath);
+            }
+
+            if (Result.IsFullySuccessful)
+            {
+                Console.ForegroundColor = ConsoleColor.Green;
+                if (Result.PatchPath == PatchPath) Console.WriteLine("Patched: " + TargetPath);
+                else Console.WriteLine("Patched: {0} (Fallback to {1})", TargetPath, Result.PatchPath);
+                Report.Record(JobStatus.Patched, TargetPath, Result.PatchPath);
+
+                if (ShouldRefresh) RefreshPatch(PatchPath, ClearedTarget, Result.Patched);
+            }
+            else
+            {
+                Console.ForegroundColor = ConsoleColor.Red;
+                Console.Error.WriteLine("Error: Patch failed ({0}/{1}): Please merge the relevant changes manually from {2} to {3}",
+                    Result.SuccessCount, Result.IsSuccess.Length, Options.HasFlag(JobOptions.DryRun) ? Result.PatchPath : Result.PatchPath + ".html", TargetPath);
+                Report.Record(JobStatus.Failed, TargetPath, $"{Result.SuccessCount}/{Result.IsSuccess.Length}");
+
+                if (Options.HasFlag(JobOptions.Relocate))
+                {
+                    var Hunks = GetHunks(Result, PatchPath, Patches, out _);
+                    for (int Index = 0; Index < Result.IsSuccess.Length; ++Index)
+                    {
+                        if (!Result.IsSuccess[Index]) FailedHunks.Add((TargetPath, Index, PatchTool.GetHunkSource(Hunks[Index])));
+                    }
+                }
+            }
+        }
+    }
+
+    private List<DiffMatchPatch.Patch> GetHunks(ApplyResult Result, string PatchPath, List<DiffMatchPatch.Patch>? Patches, out int[] Offsets)
+    {
+        var Source = Patches != null && Result.PatchPath == PatchPath ? Patches : PatchTool.ReadPatches(Result.PatchPath);
+        return PatchTool.GetHunks(Source, Result.IsSuccess.Length, out Offsets);
+    }
+
+    /// <summary>
+    /// Reports are only written when any hunk fails, showing just the failed ones, or for all hunks on demand.
+    /// Stale reports are removed once the patch applies successfully. Dry runs leave the patch directory untouched.
+    /// </summary>
+    private void WriteConflictReport(string TargetPath, string ClearedTarget, ApplyResult Result, string PatchPath, List<DiffMatchPatch.Patch>? Patches)
+    {
+        if (Options.HasFlag(JobOptions.DryRun)) return;
+
+        string ReportPath = Result.PatchPath + ".html";
+        bool OnDemand = Options.HasFlag(JobOptions.Report);
+        if (Result.IsFullySuccessful && !OnDemand)
+        {
+            if (File.Exists(ReportPath)) File.Delete(ReportPath);
+            return;
+        }
+
+        var Hunks = GetHunks(Result, PatchPath, Patches, out var Offsets);
+        var Lines = DMPContext.GetLineNumbers(ClearedTarget, Offsets);
+        Utils.FileAccessGuard(() => ConflictReport.Write(ReportPath, TargetPath, Result.PatchPath, Hunks, Result.IsSuccess, Lines, !OnDemand), ReportPath);
+    }
+
+    private const int MaxDifferenceLines = 3;
+
+    /// <summary>
+    /// Lines between the common prefix and suffix, which is where the two contents differ.
+    /// </summary>
+    private static List<string> DescribeDifference(string Expected, string Actual)
+    {
+        var ExpectedLines = Expected.Split('\n');
+        var ActualLines = Actual.Split('\n');
+        int Common = Math.Min(ExpectedLines.Length, ActualLines.Length);
+        int Prefix = 0, Suffix = 0;
+        while (Prefix < Common && ExpectedLines[Prefix] == ActualLines[Prefix]) ++Prefix;
+        while (Suffix < Common - Prefix && ExpectedLines[^(Suffix + 1)] == ActualLines[^(Suffix + 1)]) ++Suffix;
+
+        var ExpectedDiff = ExpectedLines[Prefix..^Suffix];
+        var ActualDiff = ActualLines[Prefix..^Suffix];
+        var Result = new List<string> { $"line {Prefix + 1}: {ExpectedDiff.Length} line(s) expected, {ActualDiff.Length} found" };
+        Result.AddRange(ExpectedDiff.Take(MaxDifferenceLines).Select(Line => "- " + Line.TrimEnd()));
+        Result.AddRange(ActualDiff.Take(MaxDifferenceLines).Select(Line => "+ " + Line.TrimEnd()));
+        return Result;
+    }
+
+    /// <summary>
+    /// Unpatch each target and apply the nearest patch again in memory, which should reproduce the target exactly,
+    /// and every new file should be identical to its source. Returns the difference summary, or null if up-to-date.
+    /// </summary>
+    private List<string>? VerifyTarget(string SrcPath, string TargetPath, bool IsPatch)
+    {
+        if (!File.Exists(TargetPath)) return new List<string> { "missing" };
+
+        string Current = File.ReadAllText(TargetPath);
+        if (!IsPatch)
+        {
+            string Source = PatchStorage.IsDelta(SrcPath) ? PatchStorage.Read(SrcPath) : File.ReadAllText(SrcPath);
+            return Source != Current ? DescribeDifference(Source, Current) : null;
         }
 
-        public string GetHtml(List<DiffMatchPatch.Diff> Diffs)
-        {
-            return GenerationContext.diff_prettyHtml(Diffs);
-        }
+        string Cleared = InjectionRE.Unpatch(Current);
+        string Expected = PatchTool.Apply(Cleared, SrcPath, out var IsSuccess, out _);
+        int FailedCount = IsSuccess.Count(V => !V);
+        if (FailedCount > 0) return new List<string> { $"{FailedCount}/{IsSuccess.Length} hunk(s) couldn't be applied again from {SrcPath}" };
+        if (Expected != Current) return DescribeDifference(Expected, Current);
+
+        // Unguarded changes survive both unpatching and applying, but not the base hash recorded when generating
+        if (GetBaseHash(SrcPath) is { } BaseHash && BaseHash != Utils.GetContentHash(Cleared))
+        {
+            return new List<string> { $"unpatched target differs from the one {SrcPath} is generated from, unguarded changes or engine updates" };
+        }
+        return null;
+    }
+
+    private void Verify(List<(string SrcPath, string TargetPath, bool IsPatch)> Items)
+    {
+        var Results = new List<string>?[Items.Count];
+        Parallel.For(0, Items.Count, Index => Results[Index] = VerifyTarget(Items[Index].SrcPath, Items[Index].TargetPath, Items[Index].IsPatch));
+
+        int FailedCount = 0;
+        for (int Index = 0; Index < Items.Count; ++Index)
+        {
+            if (Results[Index] is not { } Difference) continue;
+            ++FailedCount;
+            Console.ForegroundColor = ConsoleColor.Red;
+            Console.Error.WriteLine("Verify failed: {0}: {1}", Items[Index].TargetPath, Difference[0]);
+            Console.ForegroundColor = ConsoleColor.DarkGray;
+            foreach (string Line in Difference.Skip(1)) Console.Error.WriteLine("    " + Line);
+        }
+
+        Console.ForegroundColor = FailedCount > 0 ? ConsoleColor.Red : ConsoleColor.Green;
+        Console.WriteLine("Verified {0} file(s), {1} out of date", Items.Count, FailedCount);
+        VerifyFailedCount += FailedCount;
+    }
+
+    public bool IsVerified => VerifyFailedCount == 0;
+
+    /// <summary>
+    /// Store the successfully applied result as the patch for current engine version,
+    /// so that subsequent runs can match exactly instead of going through fuzzy search again.
+    /// </summary>
+    private void RefreshPatch(string PatchPath, string ClearedTarget, string Patched)
+    {
+        if (Options.HasFlag(JobOptions.DryRun)) return;
+
+        string RefreshPath = PatchStorage.Locate(PatchPath, CurrentEngineVersion.ToString());
+        if (File.Exists(RefreshPath) && PatchTool.IsExact(ClearedTarget, RefreshPath, Patched)) return;
+
+        var Diffs = PatchTool.GenerateDiffs(ClearedTarget, Patched, out var Usage);
+        ReportDiffUsage(RefreshPath, Usage);
+        string Patch = PatchTool.Generate(ClearedTarget, PatchTool.GeneratePatches(ClearedTarget, Diffs));
+        PatchStorage.Write(RefreshPath, Patch);
+        RecordBaseHash(RefreshPath, ClearedTarget);
+        Console.ForegroundColor = ConsoleColor.Green;
+        Console.WriteLine("Patch refreshed: " + RefreshPath);
+    }
+
+    private string GetBaseHashPath(string PatchPath)
+    {
+        // Local to the engine, never committed along with the patches
+        return Path.GetFullPath(Path.Combine(DstDirectory, "../Intermediate/Crysknife/BaseHashes", Utils.GetContentHash(Path.GetFullPath(PatchPath))));
+    }
+
+    /// <summary>
+    /// Remember the hash of the cleared target the patch is generated from, together with the hash of the patch itself.
+    /// </summary>
+    private void RecordBaseHash(string PatchPath, string ClearedTarget)
+    {
+        if (!File.Exists(PatchPath)) return;
+        string Record = Utils.GetContentHash(PatchStorage.Read(PatchPath)) + '\n' + Utils.GetContentHash(ClearedTarget);
+        string RecordPath = GetBaseHashPath(PatchPath);
+        if (File.Exists(RecordPath) && File.ReadAllText(RecordPath) == Record) return;
+
+        Utils.EnsureParentDirectoryExists(RecordPath);
+        Utils.FileAccessGuard(() => File.WriteAllText(RecordPath, Record), RecordPath);
+    }
+
+    /// <summary>
+    /// Hash of the cleared target the patch is generated from, null if unknown or the patch has changed since then.
+    /// </summary>
+    private string? GetBaseHash(string PatchPath)
+    {
+        string RecordPath = GetBaseHashPath(PatchPath);
+        if (!File.Exists(RecordPath)) return null;
+        string[] Record = File.ReadAllText(RecordPath).Split('\n');
+        return Record.Length == 2 && Record[0] == Utils.GetContentHash(PatchStorage.Read(PatchPath)) ? Record[1] : null;
     }
 
-    private void ProcessPatch(JobType Job, string PatchPath, string TargetPath)
+    private void ProcessFile(JobType Job, string SrcPath, string DstPath)
     {
-        string TargetContent = File.ReadAllText(TargetPath);
-        string ClearedTarget = InjectionRE.Unpatch(TargetContent);
-        List<DiffMatchPatch.Patch>? Patches = null;
+        bool Exists = File.Exists(DstPath);
+        bool IsSymLink = Exists && new FileInfo(DstPath).Attributes.HasFlag(FileAttributes.ReparsePoint);
+        bool UpToDate = Exists && !IsSymLink && File.ReadAllText(SrcPath) == File.ReadAllText(DstPath);
 
-        if (Job.HasFlag(JobType.Generate))
+        if (Job.HasFlag(JobType.Generate) && Exists && !IsSymLink && !UpToDate)
         {
-            var Diffs = PatchTool.GenerateDiffs(ClearedTarget, TargetContent);
-            Patches = PatchTool.GeneratePatches(ClearedTarget, Diffs);
-
-            if (Patches.Count == 0)
-            {
-                if (!AutoClearConfirm.HasFlag(ConfirmResult.ForAll))
-                {
-                    AutoClearConfirm = PromptToConfirm($"Couldn't find any patch from '{TargetPath}', remove?");
-                }
-                if (AutoClearConfirm.HasFlag(ConfirmResult.Yes))
-                {
-                    RemovePatchFile(TargetPath);
-                    return;
-                }
-            }
-
-            string Patch = PatchTool.Generate(Patches);
-            if (!File.Exists(PatchPath) || File.ReadAllText(PatchPath) != Patch)
+            if (Utils.FileAccessGuard(() => File.Copy(DstPath, SrcPath, true), SrcPath))
             {
-                File.WriteAllText(PatchPath + ".html", PatchTool.GetHtml(Diffs));
-                File.WriteAllText(PatchPath, Patch);
                 Console.ForegroundColor = ConsoleColor.Green;
-                Console.WriteLine("Patch updated: " + TargetPath);
+                Console.WriteLine("Copied back: {0} <- {1}", SrcPath, DstPath);
+                Report.Record(JobStatus.Generated, DstPath);
+                UpToDate = true;
             }
         }
 
-        if (Job.HasFlag(JobType.Clear) && ClearedTarget.Length != TargetContent.Length)
+        if (Job.HasFlag(JobType.Clear) && Exists)
         {
-            File.WriteAllText(TargetPath, ClearedTarget);
-            Console.ForegroundColor = ConsoleColor.Yellow;
-            Console.WriteLine("Patch removed from: " + TargetPath);
-            TargetContent = ClearedTarget;
+            bool Removed;
+            using (TargetLock.Acquire(DstPath))
+            {
+                Removed = File.Exists(DstPath); // Could be already removed by another instance
+                if (Removed) Journal.Record(DstPath);
+                if (Removed) File.Delete(DstPath);
+            }
+            if (Removed)
+            {
+                Console.ForegroundColor = ConsoleColor.Yellow;
+                Console.WriteLine("{0} removed: {1}", IsSymLink ? "Link" : "File", DstPath);
+                Report.Record(JobStatus.Cleared, DstPath);
+            }
+            Exists = IsSymLink = UpToDate = false;
         }
 
         if (Job.HasFlag(JobType.Apply))
         {
-            string Patched = Patches != null ? PatchTool.Apply(ClearedTarget, Patches, out var IsSuccess)
-                : PatchTool.Apply(ClearedTarget, PatchPath, out IsSuccess);
-            if (Patched == TargetContent) return;
+            bool ShouldBeSymLink = Options.HasFlag(JobOptions.Link);
+            if (UpToDate || IsSymLink && ShouldBeSymLink) return;
 
-            if (TargetContent.Length != ClearedTarget.Length)
+            if (Exists)
             {
                 // Apply op is potentially dangerous: Confirm before overriding any new contents.
                 if (!OverrideConfirm.HasFlag(ConfirmResult.ForAll))
                 {
-                    OverrideConfirm = PromptToConfirm($"Override already patched file {TargetPath}?");
+                    OverrideConfirm = PromptToConfirm($"Override existing file {DstPath}?");
                 }
                 if (OverrideConfirm.HasFlag(ConfirmResult.No)) return;
             }
+            else
+            {
+                Utils.EnsureParentDirectoryExists(DstPath);
+            }
 
-            File.WriteAllText(TargetPath, Patched);
+            using var Lock = TargetLock.Acquire(DstPath);
+            if (!ShouldBeSymLink && File.Exists(DstPath) && File.ReadAllText(SrcPath) == File.ReadAllText(DstPath)) return; // Done by another instance
+            Journal.Record(DstPath);
 
-            int SuccessCount = IsSuccess.Count(V => V);
-            if (SuccessCount == IsSuccess.Length)
+            if (ShouldBeSymLink ?
+                Utils.FileAccessGuard(() => File.CreateSymbolicLink(DstPath, SrcPath), DstPath) :
+                Utils.FileAccessGuard(() => File.Copy(SrcPath, DstPath, true), DstPath))
             {
                 Console.ForegroundColor = ConsoleColor.Green;
-                Console.WriteLine("Patched: " + TargetPath);
-            }
-            else
-            {
-                Console.ForegroundColor = ConsoleColor.Red;
-                Console.Error.WriteLine("Error: Patch failed ({0}/{1}): Please merge the relevant changes manually from {2} to {3}",
-                    SuccessCount, IsSuccess.Length, PatchPath + ".html", TargetPath);
+                Console.WriteLine("{0}: {1} -> {2}", ShouldBeSymLink ? "Linked" : "Copied", SrcPath, DstPath);
+                Report.Record(JobStatus.Copied, DstPath);
             }
         }
     }
 
-    private void ProcessFile(JobType Job, string SrcPath, string DstPath)
+    /// <summary>
+    /// Same as ProcessFile, but on the reconstructed content of delta patches, which can't be linked either.
+    /// </summary>
+    private void ProcessDeltaPatchAsFile(JobType Job, string PatchPath, string DstPath)
     {
+        string Content = PatchStorage.Read(PatchPath);
         bool Exists = File.Exists(DstPath);
-        bool IsSymLink = Exists && new FileInfo(DstPath).Attributes.HasFlag(FileAttributes.ReparsePoint);
-        bool UpToDate = Exists && !IsSymLink && File.ReadAllText(SrcPath) == File.ReadAllText(DstPath);
+        bool UpToDate = Exists && File.ReadAllText(DstPath) == Content;
 
-        if (Job.HasFlag(JobType.Generate) && Exists && !IsSymLink && !UpToDate)
+        if (Job.HasFlag(JobType.Generate) && Exists && !UpToDate)
         {
-            if (Utils.FileAccessGuard(() => File.Copy(DstPath, SrcPath, true), SrcPath))
+            if (Utils.FileAccessGuard(() => PatchStorage.Write(PatchPath, File.ReadAllText(DstPath)), PatchPath))
             {
                 Console.ForegroundColor = ConsoleColor.Green;
-                Console.WriteLine("Copied back: {0} <- {1}", SrcPath, DstPath);
+                Console.WriteLine("Copied back: {0} <- {1}", PatchPath, DstPath);
+                Report.Record(JobStatus.Generated, DstPath);
+                Content = PatchStorage.Read(PatchPath);
                 UpToDate = true;
             }
         }
 
         if (Job.HasFlag(JobType.Clear) && Exists)
         {
-            File.Delete(DstPath);
-            Console.ForegroundColor = ConsoleColor.Yellow;
-            Console.WriteLine("{0} removed: {1}", IsSymLink ? "Link" : "File", DstPath);
-            Exists = IsSymLink = UpToDate = false;
+            bool Removed;
+            using (TargetLock.Acquire(DstPath))
+            {
+                Removed = File.Exists(DstPath); // Could be already removed by another instance
+                if (Removed) Journal.Record(DstPath);
+                if (Removed) File.Delete(DstPath);
+            }
+            if (Removed)
+            {
+                Console.ForegroundColor = ConsoleColor.Yellow;
+                Console.WriteLine("File removed: " + DstPath);
+                Report.Record(JobStatus.Cleared, DstPath);
+            }
+            Exists = UpToDate = false;
         }
 
-        if (Job.HasFlag(JobType.Apply))
+        if (Job.HasFlag(JobType.Apply) && !UpToDate)
         {
-            bool ShouldBeSymLink = Options.HasFlag(JobOptions.Link);
-            if (UpToDate || IsSymLink && ShouldBeSymLink) return;
-
             if (Exists)
             {
                 // Apply op is potentially dangerous: Confirm before overriding any new contents.
@@ -307,39 +1382,59 @@ public class Injector
                 Utils.EnsureParentDirectoryExists(DstPath);
             }
 
-            if (ShouldBeSymLink ?
-                Utils.FileAccessGuard(() => File.CreateSymbolicLink(DstPath, SrcPath), DstPath) :
-                Utils.FileAccessGuard(() => File.Copy(SrcPath, DstPath, true), DstPath))
+            using var Lock = TargetLock.Acquire(DstPath);
+            if (File.Exists(DstPath) && File.ReadAllText(DstPath) == Content) return; // Done by another instance
+            Journal.Record(DstPath);
+
+            if (Utils.FileAccessGuard(() => File.WriteAllText(DstPath, Content), DstPath))
             {
                 Console.ForegroundColor = ConsoleColor.Green;
-                Console.WriteLine("{0}: {1} -> {2}", ShouldBeSymLink ? "Linked" : "Copied", SrcPath, DstPath);
+                Console.WriteLine("Reconstructed: {0} -> {1}", PatchPath, DstPath);
+                Report.Record(JobStatus.Copied, DstPath);
             }
         }
     }
 
+    private void CreateApplyCache()
+    {
+        // Shared by all plugins and branches working on the same engine
+        string CacheDirectory = Path.Combine(DstDirectory, "../Intermediate/Crysknife/ApplyCache");
+        ResultCache = PrivateApplyCacheSize > 0 ? new ApplyCache(CacheDirectory, PrivateApplyCacheSize) : null;
+    }
+
     private void CreatePatchTool()
     {
-        PatchTool = new DMPContext(PatchContextLength, MatchContentTolerance, MatchLineTolerance);
+        PatchTool = new DMPContext(PatchContextLength, MatchContentTolerance, MaxMatchContentTolerance, MatchLineTolerance, DiffBudget,
+            Options.HasFlag(JobOptions.TokenMatch), Options.HasFlag(JobOptions.TokenDiff), Options.HasFlag(JobOptions.RecordScopes));
     }
 
-    private static ConfigFile BaseConfig = new();
+    private static string BaseConfigPath = string.Empty;
 
     private readonly string ProjectName;
     private readonly string SrcDirectory;
     private readonly string DstDirectory;
     private readonly JobOptions Options;
 
-    private string PrivateInclusiveFilter = string.Empty;
-    private string PrivateExclusiveFilter = "NonExist";
+    private ConfigPathFilter PrivateInclusiveFilter = new(string.Empty);
+    private ConfigPathFilter PrivateExclusiveFilter = new(string.Empty);
     private short PrivatePatchContextLength = 50;
+    public const short UniquePatchContext = -1; // Only as long as the hunk is unique in the target
     private float PrivateMatchContentTolerance = 0.5f;
+    private float PrivateMaxMatchContentTolerance; // No escalation by default
     private int PrivateMatchLineTolerance = int.MaxValue; // Line number may vary significantly
+    private long PrivateDiffBudget = 1L << 27; // Roughly a second's work on typical machines
+    private long PrivateApplyCacheSize = 256L << 20;
 
     private readonly InjectionRegex InjectionRE;
     private readonly EngineVersion CurrentEngineVersion;
     private ConfirmResult OverrideConfirm;
     private ConfirmResult AutoClearConfirm;
     private DMPContext PatchTool;
+    private readonly JobReport Report = new();
+    private readonly Journal Journal;
+    private ApplyCache? ResultCache;
+    private int VerifyFailedCount;
+    private readonly List<(string TargetPath, int Hunk, string Context)> FailedHunks = new();
 
     ////////////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -351,9 +1446,11 @@ public class Injector
         Options = InOptions;
 
         InjectionRE = new InjectionRegex(ProjectName);
+        Journal = new Journal(SrcDirectory);
         CurrentEngineVersion = EngineVersion.Create(Utils.GetCurrentEngineVersion(DstDirectory));
         OverrideConfirm = Options.HasFlag(JobOptions.Force) ? ConfirmResult.Yes | ConfirmResult.ForAll : ConfirmResult.NotDecided;
         CreatePatchTool();
+        CreateApplyCache();
     }
 
     public short PatchContextLength
@@ -374,6 +1471,15 @@ public class Injector
             CreatePatchTool();
         }
     }
+    public float MaxMatchContentTolerance
+    {
+        get => PrivateMaxMatchContentTolerance;
+        set
+        {
+            PrivateMaxMatchContentTolerance = value;
+            CreatePatchTool();
+        }
+    }
     public int MatchLineTolerance
     {
         get => PrivateMatchLineTolerance;
@@ -383,15 +1489,66 @@ public class Injector
             CreatePatchTool();
         }
     }
+    public long DiffBudget
+    {
+        get => PrivateDiffBudget;
+        set
+        {
+            PrivateDiffBudget = value;
+            CreatePatchTool();
+        }
+    }
+    public long ApplyCacheSize
+    {
+        get => PrivateApplyCacheSize;
+        set
+        {
+            PrivateApplyCacheSize = value;
+            CreateApplyCache();
+        }
+    }
+    public ShardPlan Shard { get; set; } = ShardPlan.None;
+    public string? RunId { get; set; }
+
     public string InclusiveFilter
     {
-        get => PrivateInclusiveFilter;
-        set => PrivateInclusiveFilter = Utils.UnifySeparators(value);
+        get => string.Join('|', PrivateInclusiveFilter.Patterns);
+        set => PrivateInclusiveFilter = new ConfigPathFilter(value);
     }
     public string ExclusiveFilter
     {
-        get => PrivateExclusiveFilter;
-        set => PrivateExclusiveFilter = Utils.UnifySeparators(value);
+        get => string.Join('|', PrivateExclusiveFilter.Patterns);
+        set => PrivateExclusiveFilter = new ConfigPathFilter(value);
+    }
+
+    private bool IsFilteredOut(string SrcPath, string RelativePath)
+    {
+        if (!PrivateInclusiveFilter.IsEmpty && !PrivateInclusiveFilter.Matches(SrcPath, RelativePath)) return true;
+        return !PrivateExclusiveFilter.IsEmpty && PrivateExclusiveFilter.Matches(SrcPath, RelativePath);
+    }
+
+    private bool IsDirectoryFilteredOut(string SrcDirectory, string RelativeDirectory)
+    {
+        if (!PrivateInclusiveFilter.IsEmpty && !PrivateInclusiveFilter.CanMatchUnder(RelativeDirectory)) return true;
+        return !PrivateExclusiveFilter.IsEmpty && PrivateExclusiveFilter.MatchesAllUnder(SrcDirectory, RelativeDirectory);
+    }
+
+    /// <summary>
+    /// Lazily enumerate all source files, without descending into subtrees that are filtered out or skipped by config.
+    /// </summary>
+    private IEnumerable<string> EnumerateSourceFiles(string SrcDirectoryOverride, Config Config, bool VerboseLogging)
+    {
+        return new FileSystemEnumerable<string>(SrcDirectoryOverride, (ref FileSystemEntry Entry) => Entry.ToFullPath(),
+            new EnumerationOptions { RecurseSubdirectories = true })
+        {
+            ShouldIncludePredicate = (ref FileSystemEntry Entry) => !Entry.IsDirectory,
+            ShouldRecursePredicate = (ref FileSystemEntry Entry) =>
+            {
+                string SrcPath = Entry.ToFullPath();
+                string RelativePath = Path.GetRelativePath(SrcDirectoryOverride, SrcPath);
+                return !IsDirectoryFilteredOut(SrcPath, RelativePath) && !Config.SkipsDirectory(RelativePath, VerboseLogging);
+            },
+        };
     }
 
     public void CreatePatchFile(params string[] InputPaths)
@@ -421,7 +1578,7 @@ public class Injector
         {
             string RelativePath = Path.GetRelativePath(DstDirectory, PatchedPath);
             string PatchPath = Path.Combine(SrcDirectory, RelativePath + PatchDescription.MakeExtension(CurrentEngineVersion));
-            if (File.Exists(PatchPath)) continue;
+            if (PatchStorage.Find(Path.Combine(SrcDirectory, RelativePath), CurrentEngineVersion.ToString()) != null) continue;
             if (!File.ReadAllText(PatchedPath).Contains($"// {ProjectName}"))
             {
                 continue;
@@ -460,27 +1617,31 @@ public class Injector
         foreach (string PatchedPath in PatchedPaths)
         {
             string RelativePath = Path.GetRelativePath(DstDirectory, PatchedPath);
-            string PatchPath = Path.Combine(SrcDirectory, RelativePath + PatchDescription.MakeExtension(CurrentEngineVersion));
-            if (!File.Exists(PatchPath)) continue;
+            string? PatchPath = PatchStorage.Find(Path.Combine(SrcDirectory, RelativePath), CurrentEngineVersion.ToString());
+            if (PatchPath == null) continue;
 
             ProcessPatch(JobType.Clear, PatchPath, PatchedPath);
-            File.Delete(PatchPath);
+            PatchStorage.Delete(PatchPath);
             File.Delete(PatchPath + ".html");
             Console.ForegroundColor = ConsoleColor.Yellow;
             Console.WriteLine("Patch file deleted: " + PatchPath);
         }
     }
 
+    public void MigratePatches(PatchStorageMode Mode)
+    {
+        PatchStorage.Migrate(SrcDirectory, Mode);
+    }
+
     public static void Init(string RootDirectory)
     {
         ConfigFile.Init(RootDirectory);
-        string ConfigPath = Path.Combine(RootDirectory, "BaseCrysknife.ini");
-        if (File.Exists(ConfigPath)) BaseConfig = new ConfigFile(ConfigPath);
+        BaseConfigPath = Path.Combine(RootDirectory, "BaseCrysknife.ini");
     }
 
-    public void Process(JobType Job, string SrcDirectoryOverride, string VariableOverrides)
+    private Config LoadConfig(string SrcDirectoryOverride, string RootDirectory, string VariableOverrides, bool UpdateSnapshot)
     {
-        string BuiltinVariables = $"CRYSKNIFE_OUTPUT_DIRECTORY={DstDirectory},CRYSKNIFE_INPUT_DIRECTORY={SrcDirectoryOverride}";
+        string BuiltinVariables = $"CRYSKNIFE_OUTPUT_DIRECTORY={RootDirectory},CRYSKNIFE_INPUT_DIRECTORY={SrcDirectoryOverride}";
 
         if (Options.HasFlag(JobOptions.DryRun))
         {
@@ -489,50 +1650,98 @@ public class Injector
 
         VariableOverrides = string.Join(',', BuiltinVariables, VariableOverrides);
 
+        string SnapshotPath = Path.GetFullPath(Path.Combine(SrcDirectoryOverride, "../Intermediate/Crysknife/ConfigSnapshot.bin"));
+        return Crysknife.Config.Load(Path.Combine(SrcDirectoryOverride, "Crysknife.ini"), BaseConfigPath, RootDirectory, VariableOverrides,
+            SnapshotPath, UpdateSnapshot);
+    }
+
+    /// <summary>
+    /// All patches with existing targets under the specified root, keyed by target path, and optionally all new files to be copied.
+    /// </summary>
+    private Dictionary<string, PatchDescription> CollectSources(string SrcDirectoryOverride, string RootDirectory, Config Config, bool VerboseLogging,
+        List<(string SrcPath, string RelativePath, string DstRelativePath)>? NewFiles = null)
+    {
         var Patches = new Dictionary<string, PatchDescription>();
-        var Config = new Config(Path.Combine(SrcDirectoryOverride, "Crysknife.ini"), DstDirectory, BaseConfig, VariableOverrides);
-        File.WriteAllText(Path.Combine(SrcDirectoryOverride, "CrysknifeCache.ini"), Config.ToString());
+        foreach (string SrcPath in EnumerateSourceFiles(SrcDirectoryOverride, Config, VerboseLogging))
+        {
+            string RelativePath = Path.GetRelativePath(SrcDirectoryOverride, SrcPath);
+            var ParsedRelativePath = new ParsedPath(RelativePath);
+            bool IsPatch = ParsedRelativePath.Extensions.Last() == ".patch";
+            if (IsPatch) RelativePath = ParsedRelativePath.PathTrunc + ParsedRelativePath.Extensions.First();
+            if (IsFilteredOut(SrcPath, RelativePath)) continue;
+
+            if (IsPatch) // Patch existing files
+            {
+                string DstPath = Path.Combine(RootDirectory, RelativePath);
+                if (!File.Exists(DstPath)) continue;
+
+                if (!Patches.ContainsKey(RelativePath)) Patches.Add(RelativePath, new PatchDescription());
+                Patches[RelativePath].Add(ParsedRelativePath);
+            }
+            else if (NewFiles != null && Config.Remap(RelativePath, out var DstRelativePath, VerboseLogging))
+            {
+                NewFiles.Add((SrcPath, RelativePath, DstRelativePath));
+            }
+        }
+        return Patches;
+    }
+
+    public void Process(JobType Job, string SrcDirectoryOverride, string VariableOverrides)
+    {
+        var Config = LoadConfig(SrcDirectoryOverride, DstDirectory, VariableOverrides, Shard.IsPrimary && Job != JobType.Verify);
+
+        // Only touch the cache file if anything changed, and never from multiple shards
+        string CachePath = Path.Combine(SrcDirectoryOverride, "CrysknifeCache.ini");
+        string CacheContent = Config.ToString();
+        if (Shard.IsPrimary && Job != JobType.Verify && (!File.Exists(CachePath) || File.ReadAllText(CachePath) != CacheContent)) File.WriteAllText(CachePath, CacheContent);
 
         bool VerboseLogging = Options.HasFlag(JobOptions.Verbose);
         if (VerboseLogging)
         {
             Console.ForegroundColor = ConsoleColor.Gray;
-            Console.WriteLine($"Processing '{SrcDirectoryOverride}' Using Config:");
+            Console.WriteLine($"Processing '{SrcDirectoryOverride}' Using {(Config.IsFromSnapshot ? "Snapshot " : "")}Config:");
             Console.ForegroundColor = ConsoleColor.DarkGray;
             Console.WriteLine(Config);
         }
 
-        foreach (string SrcPath in Directory.GetFiles(SrcDirectoryOverride, "*", new EnumerationOptions { RecurseSubdirectories = true }))
+        var NewFiles = new List<(string SrcPath, string RelativePath, string DstRelativePath)>();
+        var Patches = CollectSources(SrcDirectoryOverride, DstDirectory, Config, VerboseLogging, NewFiles);
+
+        if (Shard.IsSharded)
         {
-            if (!SrcPath.Contains(InclusiveFilter) || SrcPath.Contains(ExclusiveFilter)) continue;
+            // New files are keyed by full path so they never collide with patch targets
+            var Selected = Shard.Select(NewFiles.Select(Entry => KeyValuePair.Create(Entry.SrcPath, new FileInfo(Entry.SrcPath).Length))
+                .Concat(Patches.Select(Pair => KeyValuePair.Create(Pair.Key, new FileInfo(Path.Combine(DstDirectory, Pair.Key)).Length))));
+            NewFiles.RemoveAll(Entry => !Selected.Contains(Entry.SrcPath));
+            foreach (string Key in Patches.Keys.Where(Key => !Selected.Contains(Key)).ToList()) Patches.Remove(Key);
 
-            string RelativePath = Path.GetRelativePath(SrcDirectoryOverride, SrcPath);
-            var ParsedRelativePath = new ParsedPath(RelativePath);
-            if (ParsedRelativePath.Extensions.Last() == ".patch") // Patch existing files
-            {
-                RelativePath = ParsedRelativePath.PathTrunc + ParsedRelativePath.Extensions.First();
-                string DstPath = Path.Combine(DstDirectory, RelativePath);
-                if (!File.Exists(DstPath)) continue;
+            Console.ForegroundColor = ConsoleColor.Gray;
+            Console.WriteLine("Shard {0}: {1} file(s), {2} patch(es)", Shard, NewFiles.Count, Patches.Count);
+        }
 
-                if (!Patches.ContainsKey(RelativePath)) Patches.Add(RelativePath, new PatchDescription());
-                Patches[RelativePath].Add(ParsedRelativePath);
-            }
-            else if (Config.Remap(RelativePath, out var DstRelativePath, VerboseLogging))
+        var VerifyItems = new List<(string SrcPath, string TargetPath, bool IsPatch)>();
+        foreach (var (SrcPath, RelativePath, DstRelativePath) in NewFiles)
+        {
+            string OutputPath = Path.Combine(DstDirectory, DstRelativePath);
+            if (Job == JobType.Verify)
             {
-                string OutputPath = Path.Combine(DstDirectory, DstRelativePath);
-
-                // When dry running, sync with original output path unconditionally
-                if (Options.HasFlag(JobOptions.DryRun) && RelativePath != DstRelativePath)
-                {
-                    Utils.EnsureParentDirectoryExists(OutputPath);
-                    string OriginalDstPath = Path.Combine(DstDirectory, RelativePath);
-                    if (File.Exists(OriginalDstPath)) Utils.FileAccessGuard(() => File.Copy(OriginalDstPath, OutputPath, true), OutputPath);
-                    else File.Delete(OutputPath);
-                }
+                VerifyItems.Add((SrcPath, OutputPath, false));
+                continue;
+            }
 
-                ProcessFile(Job, SrcPath, OutputPath);
+            // When dry running, sync with original output path unconditionally
+            if (Options.HasFlag(JobOptions.DryRun) && RelativePath != DstRelativePath)
+            {
+                Utils.EnsureParentDirectoryExists(OutputPath);
+                string OriginalDstPath = Path.Combine(DstDirectory, RelativePath);
+                Journal.Record(OutputPath);
+                if (File.Exists(OriginalDstPath)) Utils.FileAccessGuard(() => File.Copy(OriginalDstPath, OutputPath, true), OutputPath);
+                else File.Delete(OutputPath);
             }
+
+            ProcessFile(Job, SrcPath, OutputPath);
         }
+        Journal.Sync();
 
         foreach (var Pair in Patches)
         {
@@ -544,9 +1753,23 @@ public class Injector
             string PatchPath = Path.Combine(SrcDirectoryOverride, RelativePatch);
             string OutputPath = Path.Combine(DstDirectory, DstRelativePath[..^PatchSuffix.Length]);
 
+            if (Pair.Value.Conflicts.Count > 0)
+            {
+                Console.ForegroundColor = ConsoleColor.Red;
+                Console.Error.WriteLine("Error: Both full and delta patches exist for version {0} of {1}, please remove either",
+                    string.Join(", ", Pair.Value.Conflicts), Path.Combine(SrcDirectoryOverride, Pair.Key));
+                Report.Record(JobStatus.Failed, Path.Combine(DstDirectory, Pair.Key), "Conflicting patches");
+                if (Job == JobType.Verify) ++VerifyFailedCount;
+                continue;
+            }
+
             if (Options.HasFlag(JobOptions.TreatPatchAsFile))
             {
-                ProcessFile(Job, PatchPath, OutputPath + PatchSuffix);
+                // Deltas are meaningless without their bases, always output in full storage mode
+                string FilePath = PatchStorage.ToMode(OutputPath + PatchSuffix, PatchStorageMode.Full);
+                if (Job == JobType.Verify) VerifyItems.Add((PatchPath, FilePath, false));
+                else if (PatchStorage.IsDelta(PatchPath)) ProcessDeltaPatchAsFile(Job, PatchPath, FilePath);
+                else ProcessFile(Job, PatchPath, FilePath);
                 continue;
             }
 
@@ -556,6 +1779,13 @@ public class Injector
             {
                 Console.ForegroundColor = ConsoleColor.Red;
                 Console.WriteLine("Skipped patch: {0} does not exist!", TargetPath);
+                Report.Record(JobStatus.Skipped, TargetPath);
+                continue;
+            }
+
+            if (Job == JobType.Verify)
+            {
+                VerifyItems.Add((PatchPath, OutputPath, true));
                 continue;
             }
 
@@ -563,17 +1793,23 @@ public class Injector
             if (TargetPath != OutputPath && !File.Exists(OutputPath))
             {
                 Utils.EnsureParentDirectoryExists(OutputPath);
+                Journal.Record(OutputPath);
                 Utils.FileAccessGuard(() => File.Copy(TargetPath, OutputPath), OutputPath);
             }
 
             // When dry running, sync with original output path unconditionally
             if (Options.HasFlag(JobOptions.DryRun) && TargetPath != OutputPath)
             {
+                Journal.Record(OutputPath);
                 Utils.FileAccessGuard(() => File.Copy(TargetPath, OutputPath, true), OutputPath);
             }
 
-            ProcessPatch(Job, PatchPath, OutputPath);
+            var FallbackPatchPaths = Options.HasFlag(JobOptions.Cascade) ? Pair.Value.MatchFallbacks(CurrentEngineVersion)
+                .Select(Suffix => Path.Combine(SrcDirectoryOverride, Pair.Key + Suffix)).ToList() : null;
+            ProcessPatch(Job, PatchPath, OutputPath, FallbackPatchPaths);
         }
+        Journal.Sync();
+        if (Job == JobType.Verify) Verify(VerifyItems);
 
         Console.ForegroundColor = ConsoleColor.DarkBlue;
         Console.WriteLine("{0} job done: {1} <=> {2}", Job.ToString(), SrcDirectoryOverride, DstDirectory);
@@ -583,4 +1819,231 @@ public class Injector
     {
         Process(Job, SrcDirectory, VariableOverrides);
     }
+
+    private readonly struct MatrixCell
+    {
+        public readonly string PatchVersion; // Empty if the nearest version is used
+        public readonly int SuccessCount;
+        public readonly int HunkCount;
+        public readonly float Tolerance; // Max content tolerance needed among all hunks
+
+        public MatrixCell(string PatchVersion, int SuccessCount, int HunkCount, float Tolerance)
+        {
+            this.PatchVersion = PatchVersion;
+            this.SuccessCount = SuccessCount;
+            this.HunkCount = HunkCount;
+            this.Tolerance = Tolerance;
+        }
+
+        public bool IsFullySuccessful => SuccessCount == HunkCount;
+    }
+
+    /// <summary>
+    /// Apply every patch onto each of the specified engine source trees in memory, with the same version selection as the apply job,
+    /// and print the results as a patch by engine matrix. Targets identical across trees are only applied once.
+    /// Returns false if any patch fails on any tree.
+    /// </summary>
+    public bool ProcessMatrix(IReadOnlyList<string> EngineDirectories, string SrcDirectoryOverride, string VariableOverrides)
+    {
+        bool VerboseLogging = Options.HasFlag(JobOptions.Verbose);
+        var Engines = EngineDirectories.Select(Path.GetFullPath)
+            .Select(Directory => (Directory, Version: EngineVersion.Create(Utils.GetCurrentEngineVersion(Directory)))).ToList();
+
+        // Gather all the work first, so that all trees can be applied concurrently
+        var Jobs = new List<(string Target, int Engine, string PatchPath, string ContentPath, List<string>? FallbackPatchPaths)>();
+        var Rows = new SortedDictionary<string, string?[]>(StringComparer.Ordinal); // Note for each cell not applied
+        for (int Engine = 0; Engine < Engines.Count; ++Engine)
+        {
+            var (EngineDirectory, Version) = Engines[Engine];
+            var Config = LoadConfig(SrcDirectoryOverride, EngineDirectory, VariableOverrides, false);
+            foreach (var Pair in CollectSources(SrcDirectoryOverride, EngineDirectory, Config, VerboseLogging))
+            {
+                if (!Rows.TryGetValue(Pair.Key, out var Notes)) Rows.Add(Pair.Key, Notes = Enumerable.Repeat<string?>("missing", Engines.Count).ToArray());
+
+                if (Pair.Value.Conflicts.Count > 0)
+                {
+                    Notes[Engine] = "conflict";
+                    continue;
+                }
+
+                string PatchSuffix = Pair.Value.Match(Version);
+                string RelativePatch = Pair.Key + PatchSuffix;
+                if (!Config.Remap(RelativePatch, out var DstRelativePath, VerboseLogging))
+                {
+                    Notes[Engine] = "skipped";
+                    continue;
+                }
+                Notes[Engine] = null;
+
+                // Remapped targets are synced from the original source if not exist
+                string OutputPath = Path.Combine(EngineDirectory, DstRelativePath[..^PatchSuffix.Length]);
+                string ContentPath = File.Exists(OutputPath) ? OutputPath : Path.Combine(EngineDirectory, Pair.Key);
+                var FallbackPatchPaths = Options.HasFlag(JobOptions.Cascade) ? Pair.Value.MatchFallbacks(Version)
+                    .Select(Suffix => Path.Combine(SrcDirectoryOverride, Pair.Key + Suffix)).ToList() : null;
+                Jobs.Add((Pair.Key, Engine, Path.Combine(SrcDirectoryOverride, RelativePatch), ContentPath, FallbackPatchPaths));
+            }
+        }
+
+        var Shared = new ConcurrentDictionary<string, Lazy<MatrixCell>>();
+        var Cells = new MatrixCell[Jobs.Count];
+        Parallel.For(0, Jobs.Count, Index =>
+        {
+            var Job = Jobs[Index];
+            string ClearedTarget = InjectionRE.Unpatch(File.ReadAllText(Job.ContentPath));
+            var PatchPaths = Job.FallbackPatchPaths != null ? Job.FallbackPatchPaths.Prepend(Job.PatchPath) : new[] { Job.PatchPath };
+            string Key = string.Join('|', PatchPaths.Prepend(Utils.GetContentHash(ClearedTarget)));
+            Cells[Index] = Shared.GetOrAdd(Key, _ => new Lazy<MatrixCell>(() =>
+            {
+                var Result = ApplyPatchFile(ClearedTarget, Job.PatchPath, Job.FallbackPatchPaths, false); // Never fill the local cache with other trees
+                string PatchVersion = Result.PatchPath == Job.PatchPath ? string.Empty
+                    : new ParsedPath(Result.PatchPath).Extensions.First(Extension => Extension.StartsWith(".v"))[2..];
+                float Tolerance = Result.Tolerances.Where((_, Hunk) => Result.IsSuccess[Hunk]).DefaultIfEmpty(0).Max();
+                return new MatrixCell(PatchVersion, Result.SuccessCount, Result.IsSuccess.Length, Tolerance);
+            })).Value;
+        });
+
+        if (VerboseLogging)
+        {
+            Console.ForegroundColor = ConsoleColor.Gray;
+            Console.WriteLine("Applied {0} distinct target(s) for {1} patch(es) on {2} engine(s)", Shared.Count, Jobs.Count, Engines.Count);
+        }
+
+        // Engines of the same version are told apart by their order
+        var Labels = Engines.Select((Engine, Index) => Engines.Count(Other => Other.Version.Equals(Engine.Version)) > 1 ?
+            $"{Engine.Version}#{Index + 1}" : Engine.Version.ToString()).ToList();
+        var Texts = Rows.ToDictionary(Row => Row.Key, Row => Row.Value.Select(Note => (Text: Note ?? string.Empty, Color: ConsoleColor.DarkGray)).ToArray());
+        for (int Index = 0; Index < Jobs.Count; ++Index)
+        {
+            var Cell = Cells[Index];
+            string Text = Cell.IsFullySuccessful ? "ok" : $"{Cell.SuccessCount}/{Cell.HunkCount}";
+            if (Cell.IsFullySuccessful && Cell.Tolerance > MatchContentTolerance) Text += $"@{Cell.Tolerance:0.##}";
+            if (Cell.PatchVersion.Length > 0) Text += $" ({Cell.PatchVersion})";
+            var Color = !Cell.IsFullySuccessful ? ConsoleColor.Red : Text != "ok" ? ConsoleColor.Yellow : ConsoleColor.Green;
+            Texts[Jobs[Index].Target][Jobs[Index].Engine] = (Text, Color);
+        }
+
+        int TargetWidth = Texts.Keys.Select(Target => Target.Length).Append("Patch".Length).Max() + 2;
+        var Widths = Labels.Select((Label, Engine) => Texts.Values.Select(Row => Row[Engine].Text.Length).Append(Label.Length).Max() + 2).ToList();
+
+        Console.ForegroundColor = ConsoleColor.Gray;
+        Console.WriteLine("Compatibility matrix of '{0}':", SrcDirectoryOverride);
+        Console.Write("Patch".PadRight(TargetWidth));
+        for (int Engine = 0; Engine < Engines.Count; ++Engine) Console.Write(Labels[Engine].PadRight(Widths[Engine]));
+        Console.WriteLine();
+        foreach (var Row in Texts)
+        {
+            Console.ForegroundColor = ConsoleColor.Gray;
+            Console.Write(Row.Key.PadRight(TargetWidth));
+            for (int Engine = 0; Engine < Engines.Count; ++Engine)
+            {
+                Console.ForegroundColor = Row.Value[Engine].Color;
+                Console.Write(Row.Value[Engine].Text.PadRight(Widths[Engine]));
+            }
+            Console.WriteLine();
+        }
+
+        bool Compatible = !Rows.Values.Any(Notes => Notes.Contains("conflict"));
+        for (int Engine = 0; Engine < Engines.Count; ++Engine)
+        {
+            var EngineCells = Cells.Where((_, Index) => Jobs[Index].Engine == Engine).ToList();
+            int FailedCount = EngineCells.Count(Cell => !Cell.IsFullySuccessful);
+            int SuccessCount = EngineCells.Sum(Cell => Cell.SuccessCount), HunkCount = EngineCells.Sum(Cell => Cell.HunkCount);
+            Console.ForegroundColor = FailedCount > 0 ? ConsoleColor.Red : ConsoleColor.Green;
+            Console.WriteLine("{0}: {1}/{2} patch(es) applied, {3}/{4} hunk(s), {5}", Labels[Engine], EngineCells.Count - FailedCount, EngineCells.Count,
+                SuccessCount, HunkCount, Engines[Engine].Directory);
+            Compatible &= FailedCount == 0;
+        }
+        return Compatible;
+    }
+
+    public bool ProcessMatrix(IReadOnlyList<string> EngineDirectories, string VariableOverrides = "")
+    {
+        return ProcessMatrix(EngineDirectories, SrcDirectory, VariableOverrides);
+    }
+
+    private const int MaxRelocationCandidates = 3;
+
+    /// <summary>
+    /// Search the whole engine source tree for where all the failed hunks of previous jobs may have moved to, in one go.
+    /// </summary>
+    public void RelocateFailedHunks()
+    {
+        if (!Options.HasFlag(JobOptions.Relocate) || FailedHunks.Count == 0) return;
+
+        if (Shard.IsSharded)
+        {
+            // Deferred to '--merge-reports', so that the shared index is only built and written once
+            foreach (var Failed in FailedHunks) Report.RecordFailedHunk(Failed.TargetPath, Failed.Hunk, Failed.Context);
+            FailedHunks.Clear();
+            return;
+        }
+        Relocate();
+    }
+
+    private void Relocate()
+    {
+
+        string CachePath = Path.GetFullPath(Path.Combine(SrcDirectory, "../Intermediate/Crysknife/SourceIndex.bin"));
+        var Index = SourceIndex.Load(DstDirectory, CachePath, Options.HasFlag(JobOptions.Verbose));
+        var Results = Index.Search(FailedHunks.Select(Failed => Failed.Context).ToList(), MaxRelocationCandidates);
+
+        for (int Query = 0; Query < FailedHunks.Count; ++Query)
+        {
+            var (TargetPath, Hunk, _) = FailedHunks[Query];
+            if (Results[Query].Count == 0)
+            {
+                Console.ForegroundColor = ConsoleColor.Gray;
+                Console.WriteLine("No relocation candidate for hunk {0} of {1}", Hunk + 1, TargetPath);
+                continue;
+            }
+
+            Console.ForegroundColor = ConsoleColor.Yellow;
+            Console.WriteLine("Hunk {0} of {1} may have moved to:", Hunk + 1, TargetPath);
+            foreach (var Candidate in Results[Query])
+            {
+                Console.WriteLine("    {0}:{1} (score {2:0.##})", Candidate.FilePath, Candidate.Line, Candidate.Score);
+            }
+        }
+        FailedHunks.Clear();
+    }
+
+    public void BeginTransaction()
+    {
+        if (Options.HasFlag(JobOptions.DryRun)) return; // Nothing to roll back, keep the last transaction intact
+        if (!Journal.Begin(Shard, RunId)) Utils.Abort();
+    }
+
+    public void CommitTransaction()
+    {
+        Journal.Commit();
+    }
+
+    /// <summary>
+    /// Evict old apply results once after all jobs of this run, only the primary shard does so.
+    /// </summary>
+    public void TrimApplyCache()
+    {
+        if (Shard.IsPrimary) ResultCache?.Trim();
+    }
+
+    public bool Rollback()
+    {
+        return Journal.Rollback(SrcDirectory);
+    }
+
+    public void WriteShardReport()
+    {
+        if (Shard.IsSharded) Report.Write(SrcDirectory, Shard, RunId!);
+    }
+
+    public bool MergeShardReports()
+    {
+        bool Success = JobReport.Merge(SrcDirectory, RunId, out var ShardFailedHunks);
+        if (Options.HasFlag(JobOptions.Relocate) && ShardFailedHunks.Count > 0)
+        {
+            FailedHunks.AddRange(ShardFailedHunks);
+            Relocate();
+        }
+        return Success;
+    }
 }
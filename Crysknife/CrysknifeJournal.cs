@@ -0,0 +1,227 @@
+// SPDX-FileCopyrightText: 2024 Yun Hsiao Wu <yunhsiaow@gmail.com>
+// SPDX-License-Identifier: MIT
+
+namespace Crysknife;
+
+/// <summary>
+/// Write-ahead journal of all the targets modified by one run, so that an interrupted run can be rolled back
+/// by restoring only the touched files. Before the first modification of each target its pre-image is backed up
+/// and recorded as one line of 'Hash\tBackup\tTarget', where hash is '-' for newly created targets, and backup is
+/// 'link:Source' for symbolic links. Backups are fsync-ed in batches at the end of each stage.
+/// </summary>
+public class Journal
+{
+    private const string BeginMarker = "#begin";
+    private const string CommitMarker = "#commit";
+
+    private readonly string JournalDirectory;
+    private string JournalPath = string.Empty;
+    private string BackupDirectory = string.Empty;
+
+    private FileStream? Stream;
+    private StreamWriter? Writer;
+    private readonly HashSet<string> Recorded = new();
+    private readonly List<string> PendingBackups = new();
+
+    public Journal(string SrcDirectory)
+    {
+        JournalDirectory = GetDirectory(SrcDirectory);
+    }
+
+    private static string GetDirectory(string SrcDirectory)
+    {
+        return Path.GetFullPath(Path.Combine(SrcDirectory, "../Intermediate/Crysknife/Journal"));
+    }
+
+    /// <summary>
+    /// Run id from the begin marker, and whether the transaction is committed. Journals of other running shards may be written concurrently.
+    /// </summary>
+    private static (string RunId, bool Committed) ReadState(string JournalPath)
+    {
+        using var Reader = new StreamReader(new FileStream(JournalPath, FileMode.Open, FileAccess.Read, FileShare.ReadWrite | FileShare.Delete));
+        var Lines = Reader.ReadToEnd().Split('\n', StringSplitOptions.RemoveEmptyEntries | StringSplitOptions.TrimEntries);
+        string[] Begin = Lines.Length > 0 ? Lines[0].Split(' ', 3) : Array.Empty<string>();
+        return (Begin.Length > 2 ? Begin[2] : string.Empty, Lines.Length > 0 && Lines[^1] == CommitMarker);
+    }
+
+    /// <summary>
+    /// Start a new transaction, discarding the previous committed one of the same shard.
+    /// Returns false if an interrupted transaction is still pending, which is left for '--rollback'.
+    /// Only the other shards of the same run may have pending transactions at the same time.
+    /// </summary>
+    public bool Begin(ShardPlan Shard, string? RunId)
+    {
+        string Name = Shard.IsSharded ? $"Transaction.{Shard.Index + 1}.{Shard.Count}" : "Transaction";
+        JournalPath = Path.Combine(JournalDirectory, Name + ".log");
+        BackupDirectory = Path.Combine(JournalDirectory, Name);
+
+        var Pending = new List<string>();
+        foreach (string PendingPath in Directory.Exists(JournalDirectory) ? Directory.GetFiles(JournalDirectory, "Transaction*.log") : Array.Empty<string>())
+        {
+            if (new FileInfo(PendingPath).Length == 0) continue; // Nothing recorded yet
+            var State = ReadState(PendingPath);
+            if (State.Committed) continue;
+            if (Shard.IsSharded && PendingPath != JournalPath && State.RunId == RunId) continue; // Sibling shard
+            Pending.Add(PendingPath);
+        }
+        if (Pending.Count > 0)
+        {
+            Console.ForegroundColor = ConsoleColor.Red;
+            Console.Error.WriteLine("Error: Interrupted transaction found, please restore with '--rollback' first: " + string.Join(", ", Pending));
+            return false;
+        }
+
+        if (Directory.Exists(BackupDirectory)) Directory.Delete(BackupDirectory, true);
+        Directory.CreateDirectory(BackupDirectory);
+
+        Stream = new FileStream(JournalPath, FileMode.Create, FileAccess.Write, FileShare.Read);
+        Writer = new StreamWriter(Stream);
+        Writer.WriteLine("{0} {1:O} {2}", BeginMarker, DateTime.UtcNow, RunId);
+        Sync();
+        return true;
+    }
+
+    /// <summary>
+    /// Record the pre-image of the target, must be called before any modification.
+    /// </summary>
+    public void Record(string TargetPath)
+    {
+        if (Writer == null) return;
+        string FullPath = Path.GetFullPath(TargetPath);
+
+        lock (Recorded)
+        {
+            if (!Recorded.Add(FullPath)) return; // Only the first pre-image matters
+
+            var Info = new FileInfo(FullPath);
+            string Hash = "-", Backup = string.Empty;
+            if (Info.Exists && Info.LinkTarget != null)
+            {
+                Hash = "link";
+                Backup = "link:" + Info.LinkTarget;
+            }
+            else if (Info.Exists)
+            {
+                Hash = Utils.GetContentHash(File.ReadAllText(FullPath));
+                Backup = Recorded.Count.ToString();
+                File.Copy(FullPath, Path.Combine(BackupDirectory, Backup), true);
+                PendingBackups.Add(Path.Combine(BackupDirectory, Backup));
+            }
+
+            Writer.WriteLine("{0}\t{1}\t{2}", Hash, Backup, FullPath);
+            Writer.Flush(); // Survives process termination, durability is ensured per stage
+        }
+    }
+
+    /// <summary>
+    /// Flush everything recorded so far to disk.
+    /// </summary>
+    public void Sync()
+    {
+        if (Writer == null || Stream == null) return;
+
+        lock (Recorded)
+        {
+            foreach (string BackupPath in PendingBackups)
+            {
+                using var BackupStream = new FileStream(BackupPath, FileMode.Open, FileAccess.ReadWrite);
+                BackupStream.Flush(true);
+            }
+            PendingBackups.Clear();
+
+            Writer.Flush();
+            Stream.Flush(true);
+        }
+    }
+
+    public void Commit()
+    {
+        if (Writer == null) return;
+
+        Writer.WriteLine(CommitMarker);
+        Sync();
+        Writer.Dispose();
+        Writer = null;
+        Stream = null;
+    }
+
+    /// <summary>
+    /// Restore all the targets touched by the last transactions, returns false if anything couldn't be restored.
+    /// </summary>
+    public static bool Rollback(string SrcDirectory)
+    {
+        string JournalDirectory = GetDirectory(SrcDirectory);
+        var JournalPaths = Directory.Exists(JournalDirectory) ? Directory.GetFiles(JournalDirectory, "Transaction*.log") : Array.Empty<string>();
+        if (JournalPaths.Length == 0)
+        {
+            Console.ForegroundColor = ConsoleColor.Yellow;
+            Console.WriteLine("No transaction to roll back in " + JournalDirectory);
+            return true;
+        }
+
+        bool Success = true;
+        foreach (string JournalPath in JournalPaths)
+        {
+            string BackupDirectory = JournalPath[..^".log".Length];
+            var Lines = File.ReadAllLines(JournalPath);
+            bool Committed = Lines.Length > 0 && Lines[^1] == CommitMarker;
+
+            Console.ForegroundColor = ConsoleColor.Gray;
+            Console.WriteLine("Rolling back {0} transaction: {1}", Committed ? "committed" : "interrupted", JournalPath);
+
+            // Restore in reverse order, though each target only shows up once
+            foreach (string Line in Lines.Reverse())
+            {
+                string[] Fields = Line.Split('\t');
+                if (Fields.Length != 3) continue;
+                Success &= Restore(Fields[0], Fields[1], Fields[2], BackupDirectory);
+            }
+
+            File.Delete(JournalPath);
+            if (Directory.Exists(BackupDirectory)) Directory.Delete(BackupDirectory, true);
+        }
+        return Success;
+    }
+
+    private static bool Restore(string Hash, string Backup, string TargetPath, string BackupDirectory)
+    {
+        using var Lock = TargetLock.Acquire(TargetPath);
+
+        if (Hash == "-")
+        {
+            if (!File.Exists(TargetPath) && new FileInfo(TargetPath).LinkTarget == null) return true;
+            File.Delete(TargetPath);
+            Console.ForegroundColor = ConsoleColor.Yellow;
+            Console.WriteLine("Rollback removed: " + TargetPath);
+            return true;
+        }
+
+        if (Utils.GetContentIfStartsWith(Backup, "link:", out var LinkTarget) && Hash == "link")
+        {
+            if (new FileInfo(TargetPath).LinkTarget == LinkTarget) return true;
+            File.Delete(TargetPath);
+            File.CreateSymbolicLink(TargetPath, LinkTarget);
+            Console.ForegroundColor = ConsoleColor.Green;
+            Console.WriteLine("Rollback relinked: " + TargetPath);
+            return true;
+        }
+
+        string BackupPath = Path.Combine(BackupDirectory, Backup);
+        if (!File.Exists(BackupPath) || Utils.GetContentHash(File.ReadAllText(BackupPath)) != Hash)
+        {
+            Console.ForegroundColor = ConsoleColor.Red;
+            Console.Error.WriteLine("Error: Backup of '{0}' is missing or corrupted, skipped", TargetPath);
+            return false;
+        }
+
+        if (File.Exists(TargetPath) && new FileInfo(TargetPath).LinkTarget == null &&
+            Utils.GetContentHash(File.ReadAllText(TargetPath)) == Hash) return true; // Untouched
+
+        Utils.EnsureParentDirectoryExists(TargetPath);
+        if (new FileInfo(TargetPath).LinkTarget != null) File.Delete(TargetPath);
+        File.Copy(BackupPath, TargetPath, true);
+        Console.ForegroundColor = ConsoleColor.Green;
+        Console.WriteLine("Rollback restored: " + TargetPath);
+        return true;
+    }
+}
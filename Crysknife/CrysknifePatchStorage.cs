@@ -0,0 +1,407 @@
+// SPDX-FileCopyrightText: 2024 Yun Hsiao Wu <yunhsiaow@gmail.com>
+// SPDX-License-Identifier: MIT
+
+using System.Text;
+using System.Text.RegularExpressions;
+
+namespace Crysknife;
+
+internal readonly struct EngineVersion
+{
+    public readonly int Major;
+    public readonly int Minor;
+
+    public static EngineVersion Create(string Value)
+    {
+        string[] Versions = Value.Split('_');
+        return new EngineVersion(int.Parse(Versions[0]), int.Parse(Versions[1]));
+    }
+
+    public static readonly EngineVersion Empty = new(0, 0);
+
+    private EngineVersion(int InMajor, int InMinor)
+    {
+        Major = InMajor;
+        Minor = InMinor;
+    }
+
+    public override string ToString()
+    {
+        return $"{Major}_{Minor}";
+    }
+
+    public int Distance(EngineVersion Other)
+    {
+        return Math.Abs(Major - Other.Major) * 100 + Math.Abs(Minor - Other.Minor);
+    }
+
+    public int CompareTo(EngineVersion Other)
+    {
+        return Major != Other.Major ? Major.CompareTo(Other.Major) : Minor.CompareTo(Other.Minor);
+    }
+}
+
+public enum PatchStorageMode
+{
+    Full,
+    Delta,
+}
+
+/// <summary>
+/// Patches for different engine versions of the same target are mostly identical hunks,
+/// so non-base versions can be stored as hunk-level deltas against another stored version:
+///
+///     #base Target.cpp.v5_3.patch
+///     #scope.1 FEngine::Tick
+///     @@ -591,100 +591,128 @@
+///     =0
+///     @@ -2661,100 +2661,163 @@
+///      literal hunk body...
+///
+/// Where '=N' reuses the body of the N-th hunk from the base patch.
+/// Leading '#key value' lines are metadata of the patch itself, preserved in both storage modes.
+/// Deltas are only reconstructed when actually read, i.e. for the version being applied.
+/// </summary>
+public static class PatchStorage
+{
+    private static readonly Regex PatchNameRE = new (@"^(?<Target>.+)\.v(?<Version>\d+_\d+)(?<Delta>\.delta)?\.patch$", RegexOptions.Compiled);
+
+    private const char MetadataPrefix = '#';
+    private const string BaseKey = "base";
+    private const string DeltaExtension = ".delta";
+
+    private readonly struct Hunk
+    {
+        public readonly string Header;
+        public readonly string Body;
+
+        public Hunk(string Header, string Body)
+        {
+            this.Header = Header;
+            this.Body = Body;
+        }
+    }
+
+    public static string MakeExtension(string Version, PatchStorageMode Mode)
+    {
+        return Mode == PatchStorageMode.Delta ? $".v{Version}{DeltaExtension}.patch" : $".v{Version}.patch";
+    }
+
+    public static bool IsDelta(string PatchPath)
+    {
+        return PatchPath.EndsWith(DeltaExtension + ".patch", StringComparison.OrdinalIgnoreCase);
+    }
+
+    /// <summary>
+    /// Find the stored patch path for the specified target & version, regardless of storage mode.
+    /// </summary>
+    public static string? Find(string TargetPatchPrefix, string Version)
+    {
+        string FullPath = TargetPatchPrefix + MakeExtension(Version, PatchStorageMode.Full);
+        if (File.Exists(FullPath)) return FullPath;
+        string DeltaPath = TargetPatchPrefix + MakeExtension(Version, PatchStorageMode.Delta);
+        return File.Exists(DeltaPath) ? DeltaPath : null;
+    }
+
+    /// <summary>
+    /// Find the stored patch path of the same target for another version,
+    /// or where the patch should be in full storage mode if it doesn't exist yet.
+    /// </summary>
+    public static string Locate(string PatchPath, string Version)
+    {
+        Match Matched = PatchNameRE.Match(Path.GetFileName(PatchPath));
+        string TargetPatchPrefix = Path.Combine(Path.GetDirectoryName(PatchPath) ?? string.Empty, Matched.Groups["Target"].Value);
+        return Find(TargetPatchPrefix, Version) ?? TargetPatchPrefix + MakeExtension(Version, PatchStorageMode.Full);
+    }
+
+    /// <summary>
+    /// Path of the file the patch is for, or the input as-is if it isn't a patch.
+    /// </summary>
+    public static string GetTargetPath(string PatchPath)
+    {
+        Match Matched = PatchNameRE.Match(Path.GetFileName(PatchPath));
+        return Matched.Success ? PatchPath[..^(Matched.Length - Matched.Groups["Target"].Length)] : PatchPath;
+    }
+
+    public static string Read(string PatchPath)
+    {
+        return Read(PatchPath, new HashSet<string>());
+    }
+
+    private static string Read(string PatchPath, ISet<string> Visited)
+    {
+        string Content = File.ReadAllText(PatchPath);
+        if (!IsDelta(PatchPath)) return Content;
+
+        if (!Visited.Add(Path.GetFullPath(PatchPath)))
+        {
+            throw new InvalidDataException($"Circular delta patch reference: {PatchPath}");
+        }
+
+        string BaseName = GetBaseName(Content, PatchPath);
+        string BasePath = Path.Combine(Path.GetDirectoryName(PatchPath) ?? string.Empty, BaseName);
+        return Reconstruct(Content, ParseHunks(SplitMetadata(Read(BasePath, Visited), new Dictionary<string, string>())));
+    }
+
+    /// <summary>
+    /// Write the patch content in the same storage mode as the specified path.
+    /// Any delta patches referencing the path will be rebased accordingly.
+    /// </summary>
+    public static void Write(string PatchPath, string Content)
+    {
+        var Dependents = ReadDependents(PatchPath);
+
+        if (IsDelta(PatchPath) && File.Exists(PatchPath))
+        {
+            string Delta = File.ReadAllText(PatchPath);
+            string BaseName = GetBaseName(Delta, PatchPath);
+            string BasePath = Path.Combine(Path.GetDirectoryName(PatchPath) ?? string.Empty, BaseName);
+            File.WriteAllText(PatchPath, Encode(BaseName, Read(BasePath), Content));
+        }
+        else
+        {
+            File.WriteAllText(PatchPath, Content);
+        }
+
+        WriteDependents(PatchPath, Content, Dependents);
+    }
+
+    /// <summary>
+    /// Delete the patch, materializing any delta patches referencing it beforehand.
+    /// </summary>
+    public static void Delete(string PatchPath)
+    {
+        foreach (var Pair in ReadDependents(PatchPath))
+        {
+            var NestedDependents = ReadDependents(Pair.Key);
+            string FullPath = ToMode(Pair.Key, PatchStorageMode.Full);
+            File.Delete(Pair.Key);
+            File.WriteAllText(FullPath, Pair.Value);
+            WriteDependents(FullPath, Pair.Value, NestedDependents);
+        }
+        File.Delete(PatchPath);
+    }
+
+    /// <summary>
+    /// Convert all patches under the specified directory to the specified storage mode.
+    /// When converting to deltas, the latest version of each target is stored in full,
+    /// while the other versions reference the nearest version stored before them.
+    /// </summary>
+    public static void Migrate(string SrcDirectory, PatchStorageMode Mode)
+    {
+        var Targets = new Dictionary<string, List<KeyValuePair<EngineVersion, string>>>();
+
+        foreach (string PatchPath in Directory.GetFiles(SrcDirectory, "*.patch", new EnumerationOptions { RecurseSubdirectories = true }))
+        {
+            Match Matched = PatchNameRE.Match(Path.GetFileName(PatchPath));
+            if (!Matched.Success) continue;
+
+            string TargetPrefix = Path.Combine(Path.GetDirectoryName(PatchPath) ?? string.Empty, Matched.Groups["Target"].Value);
+            if (!Targets.ContainsKey(TargetPrefix)) Targets.Add(TargetPrefix, new List<KeyValuePair<EngineVersion, string>>());
+            Targets[TargetPrefix].Add(KeyValuePair.Create(EngineVersion.Create(Matched.Groups["Version"].Value), PatchPath));
+        }
+
+        // Refuse to migrate anything if any version is stored in both modes, either file may be stale
+        bool Conflicting = false;
+        foreach (var Pair in Targets)
+        {
+            var Conflicts = Pair.Value.GroupBy(Version => Version.Key).Where(Group => Group.Count() > 1).Select(Group => Group.Key).ToList();
+            if (Conflicts.Count == 0) continue;
+
+            Console.ForegroundColor = ConsoleColor.Red;
+            Console.Error.WriteLine("Error: Both full and delta patches exist for version {0} of {1}, please remove either",
+                string.Join(", ", Conflicts), Pair.Key);
+            Conflicting = true;
+        }
+        if (Conflicting) Utils.Abort();
+
+        foreach (var Pair in Targets)
+        {
+            var Versions = Pair.Value;
+            var Contents = Versions.Select(Version => Read(Version.Value)).ToList();
+            var OutputPaths = new string[Versions.Count];
+            var Written = new List<int>();
+
+            // The latest version always serves as the base
+            int BaseIndex = Enumerable.Range(0, Versions.Count).Aggregate((Acc, Index) =>
+                Versions[Index].Key.CompareTo(Versions[Acc].Key) > 0 ? Index : Acc);
+            EngineVersion BaseVersion = Versions[BaseIndex].Key;
+
+            foreach (int Index in Enumerable.Range(0, Versions.Count)
+                .OrderBy(Index => Versions[Index].Key.Distance(BaseVersion)))
+            {
+                var Version = Versions[Index].Key;
+                string OutputPath = Pair.Key + MakeExtension(Version.ToString(), PatchStorageMode.Full);
+                string OutputContent = Contents[Index];
+
+                if (Mode == PatchStorageMode.Delta && Written.Count > 0)
+                {
+                    int Nearest = Written.MinBy(Other => Versions[Other].Key.Distance(Version));
+                    string Delta = Encode(Path.GetFileName(OutputPaths[Nearest]), Contents[Nearest], Contents[Index]);
+                    // Only worth it if actually smaller
+                    if (Delta.Length < OutputContent.Length)
+                    {
+                        OutputPath = Pair.Key + MakeExtension(Version.ToString(), PatchStorageMode.Delta);
+                        OutputContent = Delta;
+                    }
+                }
+
+                if (!File.Exists(OutputPath) || File.ReadAllText(OutputPath) != OutputContent)
+                {
+                    File.WriteAllText(OutputPath, OutputContent);
+                    Console.ForegroundColor = ConsoleColor.Green;
+                    Console.WriteLine("Patch migrated: " + OutputPath);
+                }
+                if (Versions[Index].Value != OutputPath) File.Delete(Versions[Index].Value);
+
+                OutputPaths[Index] = OutputPath;
+                Written.Add(Index);
+            }
+        }
+    }
+
+    public static string ToMode(string PatchPath, PatchStorageMode Mode)
+    {
+        Match Matched = PatchNameRE.Match(Path.GetFileName(PatchPath));
+        return Path.Combine(Path.GetDirectoryName(PatchPath) ?? string.Empty,
+            Matched.Groups["Target"].Value + MakeExtension(Matched.Groups["Version"].Value, Mode));
+    }
+
+    /// <summary>
+    /// Split the leading metadata lines from the actual patch body.
+    /// </summary>
+    public static string SplitMetadata(string Content, IDictionary<string, string> Metadata)
+    {
+        int Start = 0;
+        while (Start < Content.Length && Content[Start] == MetadataPrefix)
+        {
+            int End = Content.IndexOf('\n', Start);
+            if (End < 0) End = Content.Length;
+
+            string Line = Content[(Start + 1)..End];
+            int Separator = Line.IndexOf(' ');
+            if (Separator < 0) Metadata[Line.Trim()] = string.Empty;
+            else Metadata[Line[..Separator]] = Line[(Separator + 1)..].Trim();
+
+            Start = Math.Min(End + 1, Content.Length);
+        }
+        return Content[Start..];
+    }
+
+    public static string JoinMetadata(IDictionary<string, string> Metadata, string Body)
+    {
+        var Output = new StringBuilder();
+        foreach (var Pair in Metadata.OrderBy(Pair => Pair.Key, StringComparer.Ordinal))
+        {
+            Output.Append(MetadataPrefix).Append(Pair.Key).Append(' ').Append(Pair.Value).Append('\n');
+        }
+        return Output.Append(Body).ToString();
+    }
+
+    private static string GetBaseName(string DeltaContent, string PatchPath)
+    {
+        var Metadata = new Dictionary<string, string>();
+        SplitMetadata(DeltaContent, Metadata);
+        if (!Metadata.TryGetValue(BaseKey, out var BaseName))
+        {
+            throw new InvalidDataException($"Invalid delta patch header: {PatchPath}");
+        }
+        return BaseName;
+    }
+
+    private static Dictionary<string, string> ReadDependents(string PatchPath)
+    {
+        var Dependents = new Dictionary<string, string>();
+        string? ParentDirectory = Path.GetDirectoryName(PatchPath);
+        if (ParentDirectory == null || !Directory.Exists(ParentDirectory)) return Dependents;
+
+        Match Matched = PatchNameRE.Match(Path.GetFileName(PatchPath));
+        if (!Matched.Success) return Dependents;
+
+        string PatchName = Path.GetFileName(PatchPath);
+        foreach (string Sibling in Directory.GetFiles(ParentDirectory, Matched.Groups["Target"].Value + ".v*" + DeltaExtension + ".patch"))
+        {
+            if (GetBaseName(File.ReadAllText(Sibling), Sibling) != PatchName) continue;
+            Dependents.Add(Sibling, Read(Sibling));
+        }
+        return Dependents;
+    }
+
+    private static void WriteDependents(string PatchPath, string Content, Dictionary<string, string> Dependents)
+    {
+        string PatchName = Path.GetFileName(PatchPath);
+        foreach (var Pair in Dependents)
+        {
+            File.WriteAllText(Pair.Key, Encode(PatchName, Content, Pair.Value));
+        }
+    }
+
+    private static List<Hunk> ParseHunks(string Content)
+    {
+        var Hunks = new List<Hunk>();
+        string? Header = null;
+        var Body = new StringBuilder();
+
+        foreach (string Line in Content.Split('\n'))
+        {
+            if (Line.StartsWith("@@"))
+            {
+                if (Header != null) Hunks.Add(new Hunk(Header, Body.ToString()));
+                Header = Line;
+                Body.Clear();
+            }
+            else if (Header != null && Line.Length > 0)
+            {
+                Body.Append(Line).Append('\n');
+            }
+        }
+        if (Header != null) Hunks.Add(new Hunk(Header, Body.ToString()));
+
+        return Hunks;
+    }
+
+    private static string Encode(string BaseName, string BaseContent, string Content)
+    {
+        var BaseBodies = new Dictionary<string, int>();
+        var BaseHunks = ParseHunks(SplitMetadata(BaseContent, new Dictionary<string, string>()));
+        for (int Index = 0; Index < BaseHunks.Count; ++Index)
+        {
+            BaseBodies.TryAdd(BaseHunks[Index].Body, Index);
+        }
+
+        var Metadata = new Dictionary<string, string>();
+        var Hunks = ParseHunks(SplitMetadata(Content, Metadata));
+        Metadata[BaseKey] = BaseName;
+
+        var Output = new StringBuilder();
+        foreach (var Hunk in Hunks)
+        {
+            Output.Append(Hunk.Header).Append('\n');
+            if (BaseBodies.TryGetValue(Hunk.Body, out var Index)) Output.Append('=').Append(Index).Append('\n');
+            else Output.Append(Hunk.Body);
+        }
+        return JoinMetadata(Metadata, Output.ToString());
+    }
+
+    private static string Reconstruct(string DeltaContent, List<Hunk> BaseHunks)
+    {
+        var Metadata = new Dictionary<string, string>();
+        var Hunks = ParseHunks(SplitMetadata(DeltaContent, Metadata));
+        Metadata.Remove(BaseKey);
+
+        var Output = new StringBuilder();
+        foreach (var Hunk in Hunks)
+        {
+            Output.Append(Hunk.Header).Append('\n');
+            if (Hunk.Body.StartsWith('=') && int.TryParse(Hunk.Body.AsSpan(1).TrimEnd('\n'), out var Index))
+            {
+                Output.Append(BaseHunks[Index].Body);
+            }
+            else
+            {
+                Output.Append(Hunk.Body);
+            }
+        }
+        return JoinMetadata(Metadata, Output.ToString());
+    }
+}
@@ -0,0 +1,211 @@
+// SPDX-FileCopyrightText: 2024 Yun Hsiao Wu <yunhsiaow@gmail.com>
+// SPDX-License-Identifier: MIT
+
+using System.Text;
+
+namespace Crysknife;
+
+/// <summary>
+/// Deterministic partition of the job targets across multiple processes:
+/// Every shard sees the same target list, so the same assignment is computed independently in each of them.
+/// </summary>
+public readonly struct ShardPlan
+{
+    public readonly int Index; // Zero-based
+    public readonly int Count;
+
+    public static readonly ShardPlan None = new(0, 1);
+
+    public ShardPlan(int Index, int Count)
+    {
+        this.Index = Index;
+        this.Count = Count;
+    }
+
+    /// <summary>
+    /// Parse from the one-based 'i/n' form.
+    /// </summary>
+    public static ShardPlan Parse(string Value)
+    {
+        string[] Parts = Value.Split('/');
+        if (Parts.Length != 2 || !int.TryParse(Parts[0], out var Index) || !int.TryParse(Parts[1], out var Count) ||
+            Count < 1 || Index < 1 || Index > Count)
+        {
+            throw new ArgumentException($"Invalid shard '{Value}', expecting 'i/n' where 1 <= i <= n");
+        }
+        return new ShardPlan(Index - 1, Count);
+    }
+
+    public bool IsSharded => Count > 1;
+
+    /// <summary>
+    /// Whether this shard is responsible for the outputs shared by all targets.
+    /// </summary>
+    public bool IsPrimary => Index == 0;
+
+    public override string ToString()
+    {
+        return $"{Index + 1}/{Count}";
+    }
+
+    private static uint GetStableHash(string Key)
+    {
+        uint Hash = 2166136261; // FNV-1a, independent of the process-randomized string hash
+        foreach (char Char in Key)
+        {
+            Hash = (Hash ^ Char) * 16777619;
+        }
+        return Hash;
+    }
+
+    /// <summary>
+    /// Greedily assign targets to the least loaded shard, most expensive ones first.
+    /// </summary>
+    public HashSet<string> Select(IEnumerable<KeyValuePair<string, long>> Costs)
+    {
+        var Result = new HashSet<string>();
+        var Loads = new long[Count];
+
+        foreach (var Pair in Costs.OrderByDescending(Pair => Pair.Value)
+            .ThenBy(Pair => GetStableHash(Pair.Key)).ThenBy(Pair => Pair.Key, StringComparer.Ordinal))
+        {
+            int Target = 0;
+            for (int Shard = 1; Shard < Count; ++Shard)
+            {
+                if (Loads[Shard] < Loads[Target]) Target = Shard;
+            }
+
+            Loads[Target] += Math.Max(Pair.Value, 1);
+            if (Target == Index) Result.Add(Pair.Key);
+        }
+        return Result;
+    }
+}
+
+public enum JobStatus
+{
+    Patched,
+    Failed,
+    Generated,
+    Cleared,
+    Copied,
+    Skipped,
+}
+
+/// <summary>
+/// Per-target results of one run, persisted per shard so that they can be merged afterwards.
+/// </summary>
+public class JobReport
+{
+    private readonly List<(JobStatus Status, string Target, string Detail)> Entries = new();
+    private readonly List<(string TargetPath, int Hunk, string Context)> FailedHunks = new();
+
+    public void Record(JobStatus Status, string Target, string Detail = "")
+    {
+        lock (Entries) Entries.Add((Status, Target, Detail));
+    }
+
+    /// <summary>
+    /// Failed hunks are relocated only once for all shards when merging, instead of indexing the whole tree in each of them.
+    /// </summary>
+    public void RecordFailedHunk(string TargetPath, int Hunk, string Context)
+    {
+        lock (FailedHunks) FailedHunks.Add((TargetPath, Hunk, Context));
+    }
+
+    public static string GetDirectory(string SrcDirectory)
+    {
+        return Path.GetFullPath(Path.Combine(SrcDirectory, "../Intermediate/Crysknife/Shards"));
+    }
+
+    private const string RunIdPrefix = "#run ";
+    private const string FailedHunkPrefix = "#hunk\t";
+
+    public void Write(string SrcDirectory, ShardPlan Shard, string RunId)
+    {
+        string ReportPath = Path.Combine(GetDirectory(SrcDirectory), $"Shard.{Shard.Index + 1}.{Shard.Count}.report");
+        Utils.EnsureParentDirectoryExists(ReportPath);
+        File.WriteAllLines(ReportPath, Entries.Select(Entry => $"{Entry.Status}\t{Entry.Target}\t{Entry.Detail}").Prepend(RunIdPrefix + RunId)
+            .Concat(FailedHunks.Select(Failed => $"{FailedHunkPrefix}{Failed.TargetPath}\t{Failed.Hunk}\t{Convert.ToBase64String(Encoding.UTF8.GetBytes(Failed.Context))}")));
+    }
+
+    private static (string RunId, int Count) ReadHeader(string ReportPath)
+    {
+        string Line = File.ReadLines(ReportPath).FirstOrDefault() ?? string.Empty;
+        string RunId = Line.StartsWith(RunIdPrefix) ? Line[RunIdPrefix.Length..] : string.Empty;
+        return (RunId, int.Parse(Path.GetFileName(ReportPath).Split('.')[2]));
+    }
+
+    /// <summary>
+    /// Combine all the shard reports of one run into one summary, returns false if any target failed or any shard is missing.
+    /// Reports left over by other runs are never counted, even if they share the same shard count.
+    /// </summary>
+    public static bool Merge(string SrcDirectory, string? RunId, out List<(string TargetPath, int Hunk, string Context)> FailedHunks)
+    {
+        FailedHunks = new List<(string TargetPath, int Hunk, string Context)>();
+        string ReportDirectory = GetDirectory(SrcDirectory);
+        var ReportPaths = Directory.Exists(ReportDirectory) ? Directory.GetFiles(ReportDirectory, "Shard.*.report") : Array.Empty<string>();
+        if (ReportPaths.Length == 0)
+        {
+            Console.ForegroundColor = ConsoleColor.Yellow;
+            Console.WriteLine("No shard report found in " + ReportDirectory);
+            return false;
+        }
+
+        // Defaults to the run of the latest report
+        var Headers = ReportPaths.ToDictionary(ReportPath => ReportPath, ReadHeader);
+        if (RunId == null) RunId = Headers[ReportPaths.OrderByDescending(File.GetLastWriteTimeUtc).First()].RunId;
+        else if (Headers.Values.All(Header => Header.RunId != RunId))
+        {
+            Console.ForegroundColor = ConsoleColor.Yellow;
+            Console.WriteLine("No shard report found for run '{0}' in {1}", RunId, ReportDirectory);
+            return false;
+        }
+
+        var Groups = Headers.Where(Pair => Pair.Value.RunId == RunId).GroupBy(Pair => Pair.Value.Count).ToList();
+        var Reports = Groups.OrderByDescending(Candidate => Candidate.Max(Pair => File.GetLastWriteTimeUtc(Pair.Key))).First();
+        int Count = Reports.Key;
+        bool Complete = Groups.Count == 1 && Reports.Count() == Count;
+        int Stale = ReportPaths.Length - Reports.Count();
+
+        var Merged = new JobReport();
+        foreach (string ReportPath in Reports.Select(Pair => Pair.Key).OrderBy(ReportPath => ReportPath, StringComparer.Ordinal))
+        {
+            foreach (string Line in File.ReadLines(ReportPath)) // The run header is skipped as well
+            {
+                if (Utils.GetContentIfStartsWith(Line, FailedHunkPrefix, out var FailedHunk))
+                {
+                    string[] HunkFields = FailedHunk.Split('\t');
+                    if (HunkFields.Length == 3) FailedHunks.Add((HunkFields[0], int.Parse(HunkFields[1]), Encoding.UTF8.GetString(Convert.FromBase64String(HunkFields[2]))));
+                    continue;
+                }
+
+                string[] Fields = Line.Split('\t');
+                if (Fields.Length < 3 || !Enum.TryParse<JobStatus>(Fields[0], out var Status)) continue;
+                Merged.Record(Status, Fields[1], Fields[2]);
+            }
+        }
+
+        Console.ForegroundColor = ConsoleColor.Gray;
+        Console.WriteLine("Merged {0}/{1} shard reports of run '{2}', ignored {3} other(s):", Reports.Count(), Count, RunId, Stale);
+        foreach (var Group in Merged.Entries.GroupBy(Entry => Entry.Status).OrderBy(Group => Group.Key))
+        {
+            Console.WriteLine("  {0}: {1}", Group.Key, Group.Count());
+        }
+
+        var Failures = Merged.Entries.Where(Entry => Entry.Status == JobStatus.Failed).ToList();
+        Console.ForegroundColor = ConsoleColor.Red;
+        foreach (var Failure in Failures)
+        {
+            Console.WriteLine("Failed: {0} ({1})", Failure.Target, Failure.Detail);
+        }
+
+        if (!Complete)
+        {
+            Console.ForegroundColor = ConsoleColor.Yellow;
+            if (Groups.Count > 1) Console.WriteLine("Inconsistent shard counts in run '{0}': {1}", RunId, string.Join(", ", Groups.Select(Candidate => Candidate.Key)));
+            else Console.WriteLine("Incomplete shard reports: {0} of {1} found", Reports.Count(), Count);
+        }
+        return Complete && Failures.Count == 0;
+    }
+}
@@ -0,0 +1,363 @@
+// SPDX-FileCopyrightText: 2024 Yun Hsiao Wu <yunhsiaow@gmail.com>
+// SPDX-License-Identifier: MIT
+
+using System.Runtime.CompilerServices;
+
+namespace Crysknife;
+
+/// <summary>
+/// Lightweight C++ lexer output: whitespace is dropped, everything else becomes tokens of
+/// identifiers, numbers, literals, comments and punctuators, with ids hashed from the token text.
+/// Robust to arbitrarily cut inputs, e.g. unterminated literals simply end at the end of input.
+/// </summary>
+public class CppTokens
+{
+    public readonly string Text;
+    public readonly int[] Ids;
+    public readonly int[] Starts;
+    public readonly int[] Ends;
+
+    public int Count => Ids.Length;
+
+    private static readonly string[] Punctuators =
+    {
+        "<<=", ">>=", "...", "->*", "<=>",
+        "::", "->", "++", "--", "<<", ">>", "<=", ">=", "==", "!=", "&&", "||",
+        "+=", "-=", "*=", "/=", "%=", "&=", "|=", "^=", ".*", "##",
+    };
+
+    // Token streams of targets are shared by all patches applied to the same content
+    private static readonly ConditionalWeakTable<string, CppTokens> Cache = new();
+
+    public static CppTokens Get(string Text)
+    {
+        return Cache.GetValue(Text, Key => new CppTokens(Key));
+    }
+
+    public CppTokens(string Text)
+    {
+        this.Text = Text;
+        var Ids = new List<int>();
+        var Starts = new List<int>();
+        var Ends = new List<int>();
+
+        int Cursor = 0;
+        while (Cursor < Text.Length)
+        {
+            if (char.IsWhiteSpace(Text[Cursor]) || (Text[Cursor] == '\\' && Cursor + 1 < Text.Length && Text[Cursor + 1] is '\n' or '\r'))
+            {
+                ++Cursor;
+                continue;
+            }
+
+            int Start = Cursor;
+            Cursor = ScanToken(Text, Cursor);
+            Ids.Add(string.GetHashCode(Text.AsSpan(Start, Cursor - Start)));
+            Starts.Add(Start);
+            Ends.Add(Cursor);
+        }
+
+        this.Ids = Ids.ToArray();
+        this.Starts = Starts.ToArray();
+        this.Ends = Ends.ToArray();
+    }
+
+    private static bool IsIdentifierChar(char Char)
+    {
+        return char.IsLetterOrDigit(Char) || Char == '_' || Char == '$';
+    }
+
+    private static int ScanQuoted(string Text, int Cursor, char Quote)
+    {
+        for (++Cursor; Cursor < Text.Length && Text[Cursor] != Quote && Text[Cursor] != '\n'; ++Cursor)
+        {
+            if (Text[Cursor] == '\\') ++Cursor;
+        }
+        return Math.Min(Cursor + 1, Text.Length);
+    }
+
+    private static int ScanToken(string Text, int Cursor)
+    {
+        char Char = Text[Cursor];
+        char Next = Cursor + 1 < Text.Length ? Text[Cursor + 1] : '\0';
+
+        if (Char == '/' && Next == '/')
+        {
+            int End = Text.IndexOf('\n', Cursor);
+            End = End < 0 ? Text.Length : End;
+            while (End > Cursor && char.IsWhiteSpace(Text[End - 1])) --End; // Trailing whitespaces are formatting
+            return End;
+        }
+        if (Char == '/' && Next == '*')
+        {
+            int End = Text.IndexOf("*/", Cursor + 2, StringComparison.Ordinal);
+            return End < 0 ? Text.Length : End + 2;
+        }
+        if (Char is '"' or '\'') return ScanQuoted(Text, Cursor, Char);
+        if (char.IsDigit(Char) || (Char == '.' && char.IsDigit(Next)))
+        {
+            for (++Cursor; Cursor < Text.Length; ++Cursor)
+            {
+                char Current = Text[Cursor];
+                if (Current is '+' or '-' && Text[Cursor - 1] is 'e' or 'E' or 'p' or 'P') continue;
+                if (!IsIdentifierChar(Current) && Current is not '.' and not '\'') break;
+            }
+            return Cursor;
+        }
+        if (IsIdentifierChar(Char))
+        {
+            while (Cursor < Text.Length && IsIdentifierChar(Text[Cursor])) ++Cursor;
+            // String literal prefixes, e.g. L"", u8"", R"Delim(...)Delim"
+            if (Cursor < Text.Length && Text[Cursor] == '"')
+            {
+                if (Text[Cursor - 1] != 'R') return ScanQuoted(Text, Cursor, '"');
+                int Open = Text.IndexOf('(', Cursor);
+                if (Open < 0) return Text.Length;
+                string Close = ")" + Text[(Cursor + 1)..Open] + "\"";
+                int End = Text.IndexOf(Close, Open, StringComparison.Ordinal);
+                return End < 0 ? Text.Length : End + Close.Length;
+            }
+            return Cursor;
+        }
+
+        foreach (string Punctuator in Punctuators)
+        {
+            if (string.CompareOrdinal(Text, Cursor, Punctuator, 0, Punctuator.Length) == 0) return Cursor + Punctuator.Length;
+        }
+        return Cursor + 1;
+    }
+
+    /// <summary>
+    /// Index of the first token ending after the specified character offset.
+    /// </summary>
+    public int FindToken(int Offset)
+    {
+        int Index = Array.BinarySearch(Ends, Offset + 1);
+        return Index < 0 ? ~Index : Index;
+    }
+
+    public bool TokenEquals(int Index, CppTokens Other, int OtherIndex)
+    {
+        return Ids[Index] == Other.Ids[OtherIndex] && Text.AsSpan(Starts[Index], Ends[Index] - Starts[Index])
+            .SequenceEqual(Other.Text.AsSpan(Other.Starts[OtherIndex], Other.Ends[OtherIndex] - Other.Starts[OtherIndex]));
+    }
+
+    /// <summary>
+    /// Find the occurrence of the specified token range of the pattern nearest to the expected token index,
+    /// inside the token range [From, To), or -1.
+    /// </summary>
+    public int Match(CppTokens Pattern, int First, int Count, int Expected, int From = 0, int To = int.MaxValue)
+    {
+        var Needle = Pattern.Ids.AsSpan(First, Count);
+        int Best = -1;
+        To = Math.Min(To, this.Count);
+        for (int Offset = From; Offset + Count <= To;)
+        {
+            int Found = Ids.AsSpan(Offset, To - Offset).IndexOf(Needle);
+            if (Found < 0) break;
+            Found += Offset;
+            Offset = Found + 1;
+
+            bool Verified = true;
+            for (int Index = 0; Index < Count && Verified; ++Index) Verified = TokenEquals(Found + Index, Pattern, First + Index);
+            if (!Verified) continue;
+
+            if (Best < 0 || Math.Abs(Found - Expected) < Math.Abs(Best - Expected)) Best = Found;
+            else if (Found > Expected) break; // Only getting further away from here
+        }
+        return Best;
+    }
+
+    /// <summary>
+    /// Map a character offset in the pattern to the matched text, assuming pattern token 'First' is matched at token 'Matched'.
+    /// Offsets inside tokens map exactly, offsets inside whitespaces stick to the adjacent token.
+    /// </summary>
+    public static int MapOffset(int Offset, CppTokens Pattern, int First, int Count, CppTokens Matched, int MatchedFirst)
+    {
+        int Token = Pattern.FindToken(Offset);
+        if (Token < First || Token > First + Count) return -1;
+        int Target = MatchedFirst + Token - First;
+
+        if (Token < First + Count && Offset >= Pattern.Starts[Token])
+        {
+            return Matched.Starts[Target] + Offset - Pattern.Starts[Token];
+        }
+        if (Token > First && Offset == Pattern.Ends[Token - 1])
+        {
+            return Matched.Ends[Target - 1];
+        }
+        if (Token == First + Count) return -1; // Beyond the matched range
+
+        int Floor = Target > 0 ? Matched.Ends[Target - 1] : 0;
+        return Math.Max(Matched.Starts[Target] - (Pattern.Starts[Token] - Offset), Floor);
+    }
+}
+
+/// <summary>
+/// Named scopes (namespaces, classes and functions) of C++ sources, found by a brace & declaration aware scan over the tokens.
+/// Each scope is identified by its path of enclosing names, e.g. 'UE::FThing::Tick', and spans from its declaration to the closing brace.
+/// </summary>
+public class CppScopes
+{
+    public readonly List<(string Path, int Start, int End)> Scopes = new();
+
+    private static readonly HashSet<string> ClassKeywords = new() { "class", "struct", "union", "enum" };
+    private static readonly HashSet<string> NonFunctionKeywords = new()
+    {
+        "if", "for", "while", "switch", "catch", "return", "sizeof", "alignof", "decltype", "noexcept", "throw", "co_return",
+    };
+
+    private static readonly ConditionalWeakTable<string, CppScopes> Cache = new();
+
+    public static CppScopes Get(string Text)
+    {
+        return Cache.GetValue(Text, Key => new CppScopes(Key));
+    }
+
+    public CppScopes(string Text)
+    {
+        var Tokens = CppTokens.Get(Text);
+        var Stack = new Stack<(string? Path, int Start)>();
+        int HeaderStart = 0;
+
+        for (int Index = 0; Index < Tokens.Count; ++Index)
+        {
+            string Token = GetText(Tokens, Index);
+            if (Token.StartsWith("//") || Token.StartsWith("/*"))
+            {
+                if (HeaderStart == Index) ++HeaderStart;
+                continue;
+            }
+            if (Token is "#" && IsLineStart(Tokens, Index))
+            {
+                // Skip preprocessor lines entirely
+                while (Index + 1 < Tokens.Count && (!IsLineStart(Tokens, Index + 1) || GetGap(Tokens, Index + 1).Contains('\\'))) ++Index;
+                HeaderStart = Index + 1;
+                continue;
+            }
+
+            if (Token is ";" or "}")
+            {
+                if (Token is "}" && Stack.Count > 0)
+                {
+                    var Scope = Stack.Pop();
+                    if (Scope.Path != null) Scopes.Add((Scope.Path, Scope.Start, Tokens.Ends[Index]));
+                }
+                HeaderStart = Index + 1;
+            }
+            else if (Token is "{")
+            {
+                string? Parent = Stack.FirstOrDefault(Scope => Scope.Path != null).Path;
+                string? Name = GetName(Tokens, HeaderStart, Index);
+                string? Path = Name == null ? null : Parent == null ? Name : Parent + "::" + Name;
+                Stack.Push((Path, Tokens.Starts[Math.Min(HeaderStart, Index)]));
+                HeaderStart = Index + 1;
+            }
+        }
+
+        while (Stack.Count > 0)
+        {
+            var Scope = Stack.Pop();
+            if (Scope.Path != null) Scopes.Add((Scope.Path, Scope.Start, Text.Length));
+        }
+    }
+
+    private static ReadOnlySpan<char> GetGap(CppTokens Tokens, int Index)
+    {
+        int Previous = Index > 0 ? Tokens.Ends[Index - 1] : 0;
+        return Tokens.Text.AsSpan(Previous, Tokens.Starts[Index] - Previous);
+    }
+
+    private static bool IsLineStart(CppTokens Tokens, int Index)
+    {
+        return Index == 0 || GetGap(Tokens, Index).Contains('\n');
+    }
+
+    private static string GetText(CppTokens Tokens, int Index)
+    {
+        return Tokens.Text[Tokens.Starts[Index]..Tokens.Ends[Index]];
+    }
+
+    private static bool IsIdentifier(string Token)
+    {
+        return Token.Length > 0 && (char.IsLetter(Token[0]) || Token[0] == '_');
+    }
+
+    /// <summary>
+    /// Name of the scope declared by the tokens before an opening brace, or null for anonymous blocks.
+    /// </summary>
+    private static string? GetName(CppTokens Tokens, int Begin, int End)
+    {
+        int Depth = 0, Colon = -1;
+        var Calls = new List<int>(); // Top-level '(' preceded by identifiers
+        for (int Index = Begin; Index < End; ++Index)
+        {
+            string Token = GetText(Tokens, Index);
+            if (Token is "(" or "[")
+            {
+                if (Token == "(" && Depth == 0 && Colon < 0 && Index > Begin && IsIdentifier(GetText(Tokens, Index - 1))) Calls.Add(Index);
+                ++Depth;
+            }
+            else if (Token is ")" or "]" && Depth > 0) --Depth;
+            else if (Depth > 0) continue;
+            else if (Token == "namespace")
+            {
+                return Index + 1 < End && IsIdentifier(GetText(Tokens, Index + 1)) ? GetText(Tokens, Index + 1) : "(anonymous)";
+            }
+            else if (ClassKeywords.Contains(Token))
+            {
+                // The last identifier before any base clause, skipping API macros, 'final', etc.
+                string? Name = null;
+                for (int Next = Index + 1; Next < End; ++Next)
+                {
+                    string Current = GetText(Tokens, Next);
+                    if (Current is ":" or "<") break;
+                    if (IsIdentifier(Current) && Current is not "final" and not "class" and not "struct") Name = Current;
+                }
+                return Name;
+            }
+            else if (Token == ":" && Calls.Count > 0) Colon = Index; // Constructor initializer list
+        }
+
+        if (Calls.Count == 0) return null;
+        int Call = Calls[^1];
+        string Function = GetText(Tokens, Call - 1);
+        if (NonFunctionKeywords.Contains(Function)) return null;
+
+        // Qualified names, e.g. 'FThing::~FThing'
+        int First = Call - 1;
+        while (First - 2 >= Begin && GetText(Tokens, First - 1) == "::" && IsIdentifier(GetText(Tokens, First - 2))) First -= 2;
+        if (First - 1 >= Begin && GetText(Tokens, First - 1) == "~") --First;
+        return string.Concat(Enumerable.Range(First, Call - First).Select(Index => GetText(Tokens, Index)));
+    }
+
+    /// <summary>
+    /// Path of the innermost named scope containing the specified offset, or null if at global scope.
+    /// </summary>
+    public string? Find(int Offset)
+    {
+        int Best = -1;
+        for (int Index = 0; Index < Scopes.Count; ++Index)
+        {
+            if (Scopes[Index].Start > Offset || Scopes[Index].End <= Offset) continue;
+            if (Best < 0 || Scopes[Index].Start > Scopes[Best].Start) Best = Index;
+        }
+        return Best < 0 ? null : Scopes[Best].Path;
+    }
+
+    /// <summary>
+    /// Range of the scope with the specified path nearest to the expected offset, if any.
+    /// </summary>
+    public bool Locate(string Path, int Expected, out int Start, out int End)
+    {
+        Start = End = -1;
+        foreach (var Scope in Scopes)
+        {
+            if (Scope.Path != Path) continue;
+            if (Start >= 0 && Math.Abs(Scope.Start - Expected) >= Math.Abs(Start - Expected)) continue;
+            Start = Scope.Start;
+            End = Scope.End;
+        }
+        return Start >= 0;
+    }
+}
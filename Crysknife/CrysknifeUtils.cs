@@ -1,6 +1,8 @@
 // SPDX-FileCopyrightText: 2024 Yun Hsiao Wu <yunhsiaow@gmail.com>
 // SPDX-License-Identifier: MIT
 
+using System.Security.Cryptography;
+using System.Text;
 using System.Text.RegularExpressions;
 
 namespace Crysknife;
@@ -58,6 +60,21 @@ public class InjectionRegex
     }
 }
 
+public class OrdinalMemoryComparer : IEqualityComparer<ReadOnlyMemory<char>>
+{
+    public static readonly OrdinalMemoryComparer Instance = new();
+
+    public bool Equals(ReadOnlyMemory<char> X, ReadOnlyMemory<char> Y)
+    {
+        return X.Span.SequenceEqual(Y.Span);
+    }
+
+    public int GetHashCode(ReadOnlyMemory<char> Value)
+    {
+        return string.GetHashCode(Value.Span);
+    }
+}
+
 public static class Utils
 {
     private static readonly Regex EngineVersionRE = new (@"#define\s+ENGINE_MAJOR_VERSION\s+(\d+)\s*#define\s+ENGINE_MINOR_VERSION\s+(\d+)", RegexOptions.Compiled);
@@ -96,6 +113,11 @@ public static class Utils
         });
     }
 
+    public static string GetContentHash(string Content)
+    {
+        return Convert.ToHexString(SHA256.HashData(Encoding.UTF8.GetBytes(Content)));
+    }
+
     public static void EnsureParentDirectoryExists(string TargetPath)
     {
         string? TargetDir = Path.GetDirectoryName(TargetPath);
@@ -143,9 +165,98 @@ public static class Utils
         return true;
     }
 
+    /// <summary>
+    /// Write to the target only if it still has the expected content, i.e. no other instance touched it since we read it.
+    /// </summary>
+    public static bool WriteIfUnchanged(string TargetPath, string Expected, string Content, Action? BeforeWrite = null)
+    {
+        using var Lock = TargetLock.Acquire(TargetPath);
+        if (File.Exists(TargetPath) && File.ReadAllText(TargetPath) != Expected) return false;
+        BeforeWrite?.Invoke();
+        File.WriteAllText(TargetPath, Content);
+        return true;
+    }
+
     public static void Abort()
     {
         Console.ResetColor();
         Environment.Exit(1);
     }
 }
+
+/// <summary>
+/// Advisory inter-process lock of one target file, shared by all the instances working on the same engine tree.
+/// Lock files live in the temp directory so that the engine tree stays clean, and are removed again by the last holder.
+/// </summary>
+public sealed class TargetLock : IDisposable
+{
+    private static readonly string LockDirectory = Path.Combine(Path.GetTempPath(), "Crysknife", "Locks");
+    private const int TimeoutMilliseconds = 60000;
+    private const int RetryMilliseconds = 20;
+
+    private readonly FileStream Stream;
+    private readonly string LockPath;
+
+    private TargetLock(FileStream Stream, string LockPath)
+    {
+        this.Stream = Stream;
+        this.LockPath = LockPath;
+    }
+
+    /// <summary>
+    /// Whether the lock file has been removed by its previous holder after we opened it,
+    /// in which case it no longer excludes anyone opening the path afresh.
+    /// </summary>
+    private static bool IsUnlinked(FileStream Stream, string LockPath)
+    {
+        if (OperatingSystem.IsLinux())
+        {
+            string? Target = new FileInfo($"/proc/self/fd/{Stream.SafeFileHandle.DangerousGetHandle()}").LinkTarget;
+            if (Target != null) return Target.EndsWith(" (deleted)");
+        }
+        return !File.Exists(LockPath);
+    }
+
+    public static TargetLock Acquire(string TargetPath)
+    {
+        string FullPath = Path.GetFullPath(TargetPath);
+        if (OperatingSystem.IsWindows()) FullPath = FullPath.ToUpperInvariant();
+        string LockPath = Path.Combine(LockDirectory, Utils.GetContentHash(FullPath)[..32] + ".lock");
+        Directory.CreateDirectory(LockDirectory);
+
+        var Deadline = Environment.TickCount64 + TimeoutMilliseconds;
+        while (true)
+        {
+            try
+            {
+                // Windows doesn't allow opening a file pending deletion, so the last holder simply deletes it on close
+                var Stream = new FileStream(LockPath, FileMode.OpenOrCreate, FileAccess.ReadWrite, FileShare.None, 1,
+                    OperatingSystem.IsWindows() ? FileOptions.DeleteOnClose : FileOptions.None);
+                if (OperatingSystem.IsWindows() || !IsUnlinked(Stream, LockPath)) return new TargetLock(Stream, LockPath);
+                Stream.Dispose(); // Acquired a stale one, open the path again
+            }
+            catch (Exception Ex) when (Ex is IOException or UnauthorizedAccessException && Environment.TickCount64 < Deadline)
+            {
+                Thread.Sleep(RetryMilliseconds); // Held by another instance
+            }
+            catch (Exception Ex) when (Ex is IOException or UnauthorizedAccessException)
+            {
+                Console.ForegroundColor = ConsoleColor.Red;
+                Console.Error.WriteLine("Error: Timed out waiting for other instances to release '{0}'", TargetPath);
+                Utils.Abort();
+                throw;
+            }
+        }
+    }
+
+    public void Dispose()
+    {
+        // Removed while still held, anyone waiting on the old file opens the path again after acquiring it
+        if (!OperatingSystem.IsWindows())
+        {
+            try { File.Delete(LockPath); }
+            catch (Exception Ex) when (Ex is IOException or UnauthorizedAccessException) { }
+        }
+        Stream.Dispose();
+    }
+}
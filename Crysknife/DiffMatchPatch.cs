@@ -53,6 +53,33 @@ namespace DiffMatchPatch {
   }
 
 
+  /**
+   * When a diff should give up: either a wall-clock deadline, or a budget of
+   * work units (cells explored by diff_bisect) which is reproducible
+   * regardless of CPU speed or parallel load.
+   */
+  public class DiffLimit {
+    public readonly DateTime deadline;
+    public readonly long budget;
+    // Work units consumed so far.
+    public long used;
+    // Whether the limit is hit at some point, i.e. the diff is not optimal.
+    public bool exhausted;
+
+    public DiffLimit(DateTime deadline, long budget) {
+      this.deadline = deadline;
+      this.budget = budget;
+    }
+
+    public bool Expired() {
+      if (budget > 0 ? used >= budget : DateTime.Now > deadline) {
+        exhausted = true;
+      }
+      return exhausted;
+    }
+  }
+
+
   /**
    * Class representing one diff operation.
    */
@@ -185,6 +212,9 @@ namespace DiffMatchPatch {
 
     // Number of seconds to map a diff before giving up (0 for infinity).
     public float Diff_Timeout = 1.0f;
+    // Work units to spend on a diff before giving up, which takes precedence
+    // over Diff_Timeout if positive.
+    public long Diff_Budget = 0;
     // Cost of an empty edit operation in terms of edit characters.
     public short Diff_EditCost = 4;
     // At what point is no match declared (0.0 = perfection, 1.0 = very loose).
@@ -193,6 +223,10 @@ namespace DiffMatchPatch {
     // A match this many characters away from the expected location will add
     // 1.0 to the score (0.0 is a perfect match).
     public int Match_Distance = 1000;
+    // How many lines away from the expected location to search for a match
+    // when applying patches, which bounds the cost by the window size instead
+    // of the text size (negative for unlimited).
+    public int Match_LineDistance = -1;
     // When deleting a large block of text (over ~64 characters), how close
     // do the contents have to be to match the expected contents. (0.0 =
     // perfection, 1.0 = very loose).  Note that Match_Threshold controls
@@ -231,15 +265,23 @@ namespace DiffMatchPatch {
      * @return List of Diff objects.
      */
     public List<Diff> diff_main(string text1, string text2, bool checklines) {
+      return diff_main(text1, text2, checklines, diff_newLimit());
+    }
+
+    /**
+     * Create a new limit for one diff from current settings.
+     * @return DiffLimit object.
+     */
+    public DiffLimit diff_newLimit() {
       // Set a deadline by which time the diff must be complete.
       DateTime deadline;
-      if (this.Diff_Timeout <= 0) {
+      if (this.Diff_Timeout <= 0 || this.Diff_Budget > 0) {
         deadline = DateTime.MaxValue;
       } else {
         deadline = DateTime.Now +
             new TimeSpan(((long)(Diff_Timeout * 1000)) * 10000);
       }
-      return diff_main(text1, text2, checklines, deadline);
+      return new DiffLimit(deadline, Diff_Budget);
     }
 
     /**
@@ -250,13 +292,14 @@ namespace DiffMatchPatch {
      * @param checklines Speedup flag.  If false, then don't run a
      *     line-level diff first to identify the changed areas.
      *     If true, then run a faster slightly less optimal diff.
-     * @param deadline Time when the diff should be complete by.  Used
-     *     internally for recursive calls.  Users should set DiffTimeout
-     *     instead.
+     * @param limit When the diff should give up, also tracks the work
+     *     consumed.  Used internally for recursive calls.  Users should
+     *     set Diff_Timeout or Diff_Budget instead, unless interested in
+     *     the work consumed.
      * @return List of Diff objects.
      */
-    private List<Diff> diff_main(string text1, string text2, bool checklines,
-        DateTime deadline) {
+    public List<Diff> diff_main(string text1, string text2, bool checklines,
+        DiffLimit limit) {
       // Check for null inputs not needed since null can't be passed in C#.
 
       // Check for equality (speedup).
@@ -282,7 +325,7 @@ namespace DiffMatchPatch {
       text2 = text2.Substring(0, text2.Length - commonlength);
 
       // Compute the diff on the middle block.
-      diffs = diff_compute(text1, text2, checklines, deadline);
+      diffs = diff_compute(text1, text2, checklines, limit);
 
       // Restore the prefix and suffix.
       if (commonprefix.Length != 0) {
@@ -304,11 +347,11 @@ namespace DiffMatchPatch {
      * @param checklines Speedup flag.  If false, then don't run a
      *     line-level diff first to identify the changed areas.
      *     If true, then run a faster slightly less optimal diff.
-     * @param deadline Time when the diff should be complete by.
+     * @param limit When the diff should give up.
      * @return List of Diff objects.
      */
     private List<Diff> diff_compute(string text1, string text2,
-                                    bool checklines, DateTime deadline) {
+                                    bool checklines, DiffLimit limit) {
       List<Diff> diffs = new List<Diff>();
 
       if (text1.Length == 0) {
@@ -354,8 +397,8 @@ namespace DiffMatchPatch {
         string text2_b = hm[3];
         string mid_common = hm[4];
         // Send both pairs off for separate processing.
-        List<Diff> diffs_a = diff_main(text1_a, text2_a, checklines, deadline);
-        List<Diff> diffs_b = diff_main(text1_b, text2_b, checklines, deadline);
+        List<Diff> diffs_a = diff_main(text1_a, text2_a, checklines, limit);
+        List<Diff> diffs_b = diff_main(text1_b, text2_b, checklines, limit);
         // Merge the results.
         diffs = diffs_a;
         diffs.Add(new Diff(Operation.EQUAL, mid_common));
@@ -364,10 +407,10 @@ namespace DiffMatchPatch {
       }
 
       if (checklines && text1.Length > 100 && text2.Length > 100) {
-        return diff_lineMode(text1, text2, deadline);
+        return diff_lineMode(text1, text2, limit);
       }
 
-      return diff_bisect(text1, text2, deadline);
+      return diff_bisect(text1, text2, limit);
     }
 
     /**
@@ -376,18 +419,18 @@ namespace DiffMatchPatch {
      * This speedup can produce non-minimal diffs.
      * @param text1 Old string to be diffed.
      * @param text2 New string to be diffed.
-     * @param deadline Time when the diff should be complete by.
+     * @param limit When the diff should give up.
      * @return List of Diff objects.
      */
     private List<Diff> diff_lineMode(string text1, string text2,
-                                     DateTime deadline) {
+                                     DiffLimit limit) {
       // Scan the text on a line-by-line basis first.
       Object[] a = diff_linesToChars(text1, text2);
       text1 = (string)a[0];
       text2 = (string)a[1];
       List<string> linearray = (List<string>)a[2];
 
-      List<Diff> diffs = diff_main(text1, text2, false, deadline);
+      List<Diff> diffs = diff_main(text1, text2, false, limit);
 
       // Convert the diff back to original text.
       diff_charsToLines(diffs, linearray);
@@ -420,7 +463,7 @@ namespace DiffMatchPatch {
                   count_delete + count_insert);
               pointer = pointer - count_delete - count_insert;
               List<Diff> subDiff =
-                  this.diff_main(text_delete, text_insert, false, deadline);
+                  this.diff_main(text_delete, text_insert, false, limit);
               diffs.InsertRange(pointer, subDiff);
               pointer = pointer + subDiff.Count;
             }
@@ -443,11 +486,11 @@ namespace DiffMatchPatch {
      * See Myers 1986 paper: An O(ND) Difference Algorithm and Its Variations.
      * @param text1 Old string to be diffed.
      * @param text2 New string to be diffed.
-     * @param deadline Time at which to bail if not yet complete.
+     * @param limit When to bail if not yet complete.
      * @return List of Diff objects.
      */
     protected List<Diff> diff_bisect(string text1, string text2,
-        DateTime deadline) {
+        DiffLimit limit) {
       // Cache the text lengths to prevent multiple calls.
       int text1_length = text1.Length;
       int text2_length = text2.Length;
@@ -473,10 +516,13 @@ namespace DiffMatchPatch {
       int k2start = 0;
       int k2end = 0;
       for (int d = 0; d < max_d; d++) {
-        // Bail out if deadline is reached.
-        if (DateTime.Now > deadline) {
+        // Bail out if deadline is reached or budget is used up.
+        if (limit.Expired()) {
           break;
         }
+        // Account for the cells to be explored in this step.
+        limit.used += Math.Max(0, (2 * d - k1start - k1end) / 2 + 1)
+            + Math.Max(0, (2 * d - k2start - k2end) / 2 + 1);
 
         // Walk the front path one step.
         for (int k1 = -d + k1start; k1 <= d - k1end; k1 += 2) {
@@ -507,7 +553,7 @@ namespace DiffMatchPatch {
               int x2 = text1_length - v2[k2_offset];
               if (x1 >= x2) {
                 // Overlap detected.
-                return diff_bisectSplit(text1, text2, x1, y1, deadline);
+                return diff_bisectSplit(text1, text2, x1, y1, limit);
               }
             }
           }
@@ -545,7 +591,7 @@ namespace DiffMatchPatch {
               x2 = text1_length - v2[k2_offset];
               if (x1 >= x2) {
                 // Overlap detected.
-                return diff_bisectSplit(text1, text2, x1, y1, deadline);
+                return diff_bisectSplit(text1, text2, x1, y1, limit);
               }
             }
           }
@@ -566,19 +612,19 @@ namespace DiffMatchPatch {
      * @param text2 New string to be diffed.
      * @param x Index of split point in text1.
      * @param y Index of split point in text2.
-     * @param deadline Time at which to bail if not yet complete.
+     * @param limit When to bail if not yet complete.
      * @return LinkedList of Diff objects.
      */
     private List<Diff> diff_bisectSplit(string text1, string text2,
-        int x, int y, DateTime deadline) {
+        int x, int y, DiffLimit limit) {
       string text1a = text1.Substring(0, x);
       string text2a = text2.Substring(0, y);
       string text1b = text1.Substring(x);
       string text2b = text2.Substring(y);
 
       // Compute both diffs serially.
-      List<Diff> diffs = diff_main(text1a, text2a, false, deadline);
-      List<Diff> diffsb = diff_main(text1b, text2b, false, deadline);
+      List<Diff> diffs = diff_main(text1a, text2a, false, limit);
+      List<Diff> diffsb = diff_main(text1b, text2b, false, limit);
 
       diffs.AddRange(diffsb);
       return diffs;
@@ -764,7 +810,7 @@ namespace DiffMatchPatch {
      */
 
     protected string[] diff_halfMatch(string text1, string text2) {
-      if (this.Diff_Timeout <= 0) {
+      if (this.Diff_Timeout <= 0 && this.Diff_Budget <= 0) {
         // Don't risk returning a non-optimal diff if we have unlimited time.
         return null;
       }
@@ -1541,6 +1587,21 @@ namespace DiffMatchPatch {
      * @return Best match index or -1.
      */
     public int match_main(string text, string pattern, int loc) {
+      return match_main(text, pattern, loc, Match_Threshold);
+    }
+
+    /**
+     * Locate the best instance of 'pattern' in 'text' near 'loc', with
+     * the specified threshold instead of Match_Threshold.
+     * Returns -1 if no match found.
+     * @param text The text to search.
+     * @param pattern The pattern to search for.
+     * @param loc The location to search around.
+     * @param threshold At what point is no match declared.
+     * @return Best match index or -1.
+     */
+    public int match_main(string text, string pattern, int loc,
+        double threshold) {
       // Check for null inputs not needed since null can't be passed in C#.
 
       loc = Math.Max(0, Math.Min(loc, text.Length));
@@ -1556,7 +1617,7 @@ namespace DiffMatchPatch {
         return loc;
       } else {
         // Do a fuzzy compare.
-        return match_bitap(text, pattern, loc);
+        return match_bitap(text, pattern, loc, threshold);
       }
     }
 
@@ -1566,9 +1627,11 @@ namespace DiffMatchPatch {
      * @param text The text to search.
      * @param pattern The pattern to search for.
      * @param loc The location to search around.
+     * @param threshold At what point is no match declared.
      * @return Best match index or -1.
      */
-    protected int match_bitap(string text, string pattern, int loc) {
+    protected int match_bitap(string text, string pattern, int loc,
+        double threshold) {
       // assert (Match_MaxBits == 0 || pattern.Length <= Match_MaxBits)
       //    : "Pattern too long for this application.";
 
@@ -1576,7 +1639,7 @@ namespace DiffMatchPatch {
       Dictionary<char, int> s = match_alphabet(pattern);
 
       // Highest score beyond which we give up.
-      double score_threshold = Match_Threshold;
+      double score_threshold = threshold;
       // Is there a nearby exact match? (speedup)
       int best_loc = text.IndexOf(pattern, loc, StringComparison.Ordinal);
       if (best_loc != -1) {
@@ -1914,6 +1977,38 @@ namespace DiffMatchPatch {
      *      bool values.
      */
     public Object[] patch_apply(List<Patch> patches, string text) {
+      return patch_apply(patches, text, null);
+    }
+
+    /**
+     * Merge a set of patches onto the text, with per-patch match thresholds.
+     * @param patches Array of Patch objects
+     * @param text Old text.
+     * @param thresholds Match threshold of each patch after patch_addPadding
+     *     and patch_splitMax, or null to use Match_Threshold for all.
+     * @return Two element Object array, containing the new text and an array of
+     *      bool values.
+     */
+    public Object[] patch_apply(List<Patch> patches, string text,
+        float[]? thresholds) {
+      return patch_apply(patches, text, thresholds, null);
+    }
+
+    /**
+     * Merge a set of patches onto the text, with per-patch match thresholds
+     * and search windows.
+     * @param patches Array of Patch objects
+     * @param text Old text.
+     * @param thresholds Match threshold of each patch after patch_addPadding
+     *     and patch_splitMax, or null to use Match_Threshold for all.
+     * @param windows Start and end pairs of each patch after patch_addPadding
+     *     and patch_splitMax, in the padded old text, to restrict the search
+     *     in.  Negative for no restriction, or null for none at all.
+     * @return Two element Object array, containing the new text and an array of
+     *      bool values.
+     */
+    public Object[] patch_apply(List<Patch> patches, string text,
+        float[]? thresholds, int[]? windows) {
       if (patches.Count == 0) {
         return new Object[] { text, new bool[0] };
       }
@@ -1924,35 +2019,166 @@ namespace DiffMatchPatch {
       string nullPadding = this.patch_addPadding(patches);
       text = nullPadding + text + nullPadding;
       patch_splitMax(patches);
+      int[]? line_starts = Match_LineDistance >= 0 ? match_lineStarts(text) : null;
+
+      return patch_applyInOrder(patches, text, nullPadding, thresholds,
+          windows, line_starts, null);
+    }
+
+    /**
+     * Merge a set of patches onto the text like patch_apply, with the same
+     * result, but locate the patches with bounded search windows (from the
+     * specified windows or Match_LineDistance) concurrently against the
+     * unmodified text first.  The ordered pass of patch_apply then takes a
+     * speculative location only if the patch is expected at the very same
+     * spot and its whole search window is still untouched by the previous
+     * patches, i.e. the search would have been repeated on identical text.
+     * Everything else is located in order as usual.
+     * @param patches Array of Patch objects
+     * @param text Old text.
+     * @param thresholds Match threshold of each patch after patch_addPadding
+     *     and patch_splitMax, or null to use Match_Threshold for all.
+     * @param windows Search windows like patch_apply, or null for none at all.
+     * @return Two element Object array, containing the new text and an array of
+     *      bool values.
+     */
+    public Object[] patch_applyParallel(List<Patch> patches, string text,
+        float[]? thresholds, int[]? windows) {
+      if (patches.Count == 0) {
+        return new Object[] { text, new bool[0] };
+      }
+
+      // Deep copy the patches so that no changes are made to originals.
+      patches = patch_deepCopy(patches);
+
+      string nullPadding = this.patch_addPadding(patches);
+      text = nullPadding + text + nullPadding;
+      patch_splitMax(patches);
+      int[]? line_starts = Match_LineDistance >= 0 ? match_lineStarts(text) : null;
+
+      // Expected locations in the unmodified text.
+      int count = patches.Count;
+      int[] expected = new int[count];
+      bool[] chained = new bool[count];
+      int change = 0;
+      for (int x = 0; x < count; x++) {
+        expected[x] = patches[x].start2 - change;
+        chained[x] = x > 0
+            && expected[x] < expected[x - 1] + patches[x - 1].length1;
+        change += patches[x].length2 - patches[x].length1;
+      }
+
+      // Locate all independent patches concurrently.  Deltas are propagated
+      // from located patches to the following ones round after round, until
+      // nothing more can be located.  Unbounded searches cover the whole
+      // text, which always differs from the unmodified one, so they are not
+      // worth speculating on.
+      PatchSpeculation speculation = new PatchSpeculation(count);
+      string original = text;
+      int[] deltas = new int[count];
+      bool progressed = true;
+      while (progressed) {
+        for (int x = 1; x < count; x++) {
+          deltas[x] = speculation.starts[x - 1] != -1
+              ? speculation.starts[x - 1] - expected[x - 1] : deltas[x - 1];
+        }
+        List<int> pending = Enumerable.Range(0, count).Where(x => !chained[x]
+            && speculation.starts[x] == -1
+            && speculation.expected[x] != expected[x] + deltas[x]).ToList();
+        Parallel.ForEach(pending, x => {
+          int expected_loc = expected[x] + deltas[x];
+          string text1 = diff_text1(patches[x].diffs);
+          if (!patch_window(original.Length, text1, expected_loc, windows, x,
+              line_starts, 0, out int window_start, out int window_end)) {
+            return;
+          }
+          double threshold = thresholds != null ? thresholds[x] : Match_Threshold;
+          speculation.starts[x] = patch_locateWindowed(original, text1,
+              expected_loc, threshold, windows, x, line_starts, 0,
+              out speculation.ends[x]);
+          speculation.expected[x] = expected_loc;
+          speculation.window_starts[x] = window_start;
+          speculation.window_ends[x] = window_end;
+        });
+        progressed = pending.Any(x => speculation.starts[x] != -1);
+      }
+
+      return patch_applyInOrder(patches, text, nullPadding, thresholds,
+          windows, line_starts, speculation);
+    }
+
+    /**
+     * Locations of patches found concurrently in the unmodified text.
+     */
+    private class PatchSpeculation {
+      // Location each patch was searched around, int.MinValue if never.
+      public readonly int[] expected;
+      public readonly int[] starts;
+      public readonly int[] ends;
+      public readonly int[] window_starts;
+      public readonly int[] window_ends;
+
+      public PatchSpeculation(int count) {
+        expected = Enumerable.Repeat(int.MinValue, count).ToArray();
+        starts = Enumerable.Repeat(-1, count).ToArray();
+        ends = new int[count];
+        window_starts = new int[count];
+        window_ends = new int[count];
+      }
+    }
 
+    /**
+     * The ordered pass of patch_apply.
+     * @param patches Array of Patch objects, after patch_addPadding and
+     *     patch_splitMax.
+     * @param text Old text, with padding.
+     * @param nullPadding The padding to strip off afterwards.
+     * @param thresholds Match threshold of each patch, or null.
+     * @param windows Search windows of all patches, or null.
+     * @param line_starts Line offsets of the padded old text, or null.
+     * @param speculation Locations found in the padded old text, or null.
+     * @return Two element Object array, containing the new text and an array of
+     *      bool values.
+     */
+    private Object[] patch_applyInOrder(List<Patch> patches, string text,
+        string nullPadding, float[]? thresholds, int[]? windows,
+        int[]? line_starts, PatchSpeculation? speculation) {
+      int initialLength = text.Length;
       int x = 0;
       // delta keeps track of the offset between the expected and actual
       // location of the previous patch.  If there are patches expected at
       // positions 10 and 20, but the first patch was found at 12, delta is 2
       // and the second patch has an effective expected position of 22.
       int delta = 0;
+      // Everything from dirty_end on is the old text, only shifted.
+      int dirty_end = 0;
       bool[] results = new bool[patches.Count];
       foreach (Patch aPatch in patches) {
         int expected_loc = aPatch.start2 + delta;
         string text1 = diff_text1(aPatch.diffs);
+        double threshold = thresholds != null ? thresholds[x] : Match_Threshold;
+        // Windows shift with all the patches applied so far.
+        int shift = text.Length - initialLength;
+        int end_loc;
         int start_loc;
-        int end_loc = -1;
-        if (text1.Length > this.Match_MaxBits) {
-          // patch_splitMax will only provide an oversized pattern
-          // in the case of a monster delete.
-          start_loc = match_main(text,
-              text1.Substring(0, this.Match_MaxBits), expected_loc);
+        if (speculation != null && speculation.expected[x] == expected_loc - shift
+            && patch_window(text.Length, text1, expected_loc, windows, x,
+                line_starts, shift, out int window_start, out int window_end)
+            && window_start >= dirty_end
+            && window_start == speculation.window_starts[x] + shift
+            && window_end == speculation.window_ends[x] + shift) {
+          // The same search on the same text.
+          start_loc = speculation.starts[x];
+          end_loc = speculation.ends[x];
           if (start_loc != -1) {
-            end_loc = match_main(text,
-                text1.Substring(text1.Length - this.Match_MaxBits),
-                expected_loc + text1.Length - this.Match_MaxBits);
-            if (end_loc == -1 || start_loc >= end_loc) {
-              // Can't find valid trailing context.  Drop this patch.
-              start_loc = -1;
+            start_loc += shift;
+            if (end_loc != -1) {
+              end_loc += shift;
             }
           }
         } else {
-          start_loc = this.match_main(text, text1, expected_loc);
+          start_loc = patch_locateWindowed(text, text1, expected_loc, threshold,
+              windows, x, line_starts, shift, out end_loc);
         }
         if (start_loc == -1) {
           // No match found.  :(
@@ -1961,49 +2187,16 @@ namespace DiffMatchPatch {
           delta -= aPatch.length2 - aPatch.length1;
         } else {
           // Found a match.  :)
-          results[x] = true;
           delta = start_loc - expected_loc;
-          string text2;
-          if (end_loc == -1) {
-            text2 = text.JavaSubstring(start_loc,
-                Math.Min(start_loc + text1.Length, text.Length));
-          } else {
-            text2 = text.JavaSubstring(start_loc,
-                Math.Min(end_loc + this.Match_MaxBits, text.Length));
-          }
-          if (text1 == text2) {
-            // Perfect match, just shove the Replacement text in.
-            text = text.Substring(0, start_loc) + diff_text2(aPatch.diffs)
-                + text.Substring(start_loc + text1.Length);
-          } else {
-            // Imperfect match.  Run a diff to get a framework of equivalent
-            // indices.
-            List<Diff> diffs = diff_main(text1, text2, false);
-            if (text1.Length > this.Match_MaxBits
-                && this.diff_levenshtein(diffs) / (float) text1.Length
-                > this.Patch_DeleteThreshold) {
-              // The end points match, but the content is unacceptably bad.
-              results[x] = false;
-            } else {
-              diff_cleanupSemanticLossless(diffs);
-              int index1 = 0;
-              foreach (Diff aDiff in aPatch.diffs) {
-                if (aDiff.operation != Operation.EQUAL) {
-                  int index2 = diff_xIndex(diffs, index1);
-                  if (aDiff.operation == Operation.INSERT) {
-                    // Insertion
-                    text = text.Insert(start_loc + index2, aDiff.text);
-                  } else if (aDiff.operation == Operation.DELETE) {
-                    // Deletion
-                    text = text.Remove(start_loc + index2, diff_xIndex(diffs,
-                        index1 + aDiff.text.Length) - index2);
-                  }
-                }
-                if (aDiff.operation != Operation.DELETE) {
-                  index1 += aDiff.text.Length;
-                }
-              }
-            }
+          string text2 = patch_matchedText(text, text1, start_loc, end_loc);
+          string replacement;
+          results[x] = patch_splice(aPatch, text1, text2, out replacement);
+          if (results[x]) {
+            text = text.Substring(0, start_loc) + replacement
+                + text.Substring(start_loc + text2.Length);
+            int growth = replacement.Length - text2.Length;
+            dirty_end = Math.Max(dirty_end > start_loc ? dirty_end + growth : 0,
+                start_loc + replacement.Length);
           }
         }
         x++;
@@ -2014,6 +2207,214 @@ namespace DiffMatchPatch {
       return new Object[] { text, results };
     }
 
+    /**
+     * The search window of a patch, restricted by both the specified window
+     * and Match_LineDistance.
+     * @param length Length of the text to search, with padding.
+     * @param text1 Source text of the patch.
+     * @param expected_loc The location to search around.
+     * @param windows Search windows of all patches, or null.
+     * @param x Index of the patch.
+     * @param line_starts Line offsets of the unmodified text, or null.
+     * @param shift Offset of the text from the unmodified one around here.
+     * @param window_start Start of the window.
+     * @param window_end End of the window.
+     * @return False if the search is not restricted at all.
+     */
+    private bool patch_window(int length, string text1, int expected_loc,
+        int[]? windows, int x, int[]? line_starts, int shift,
+        out int window_start, out int window_end) {
+      window_start = 0;
+      window_end = length;
+      bool windowed = false;
+      if (windows != null && windows[2 * x] >= 0) {
+        window_start = windows[2 * x] + shift;
+        window_end = windows[2 * x + 1] + shift;
+        windowed = true;
+      }
+      if (line_starts != null) {
+        // Line offsets are taken from the old text, where everything after
+        // the previous patches is only shifted.
+        match_lineWindow(line_starts, expected_loc - shift, text1.Length,
+            out int line_start, out int line_end);
+        window_start = Math.Max(window_start, line_start + shift);
+        window_end = Math.Min(window_end, line_end + shift);
+        windowed = true;
+      }
+      window_start = Math.Max(0, Math.Min(window_start, length));
+      window_end = Math.Max(window_start, Math.Min(window_end, length));
+      return windowed;
+    }
+
+    /**
+     * Locate a patch inside its search window, restricted by both the
+     * specified window and Match_LineDistance.
+     * @param text Text to search, with padding.
+     * @param text1 Source text of the patch.
+     * @param expected_loc The location to search around.
+     * @param threshold At what point is no match declared.
+     * @param windows Search windows of all patches, or null.
+     * @param x Index of the patch.
+     * @param line_starts Line offsets of the unmodified text, or null.
+     * @param shift Offset of the text from the unmodified one around here.
+     * @param end_loc Start of the trailing context for oversized patterns,
+     *     or -1.
+     * @return Best match index or -1.
+     */
+    private int patch_locateWindowed(string text, string text1, int expected_loc,
+        double threshold, int[]? windows, int x, int[]? line_starts, int shift,
+        out int end_loc) {
+      if (!patch_window(text.Length, text1, expected_loc, windows, x,
+          line_starts, shift, out int window_start, out int window_end)) {
+        return patch_locate(text, text1, expected_loc, threshold, out end_loc);
+      }
+
+      int start_loc = patch_locate(
+          text.Substring(window_start, window_end - window_start), text1,
+          expected_loc - window_start, threshold, out end_loc);
+      if (start_loc != -1) {
+        start_loc += window_start;
+        if (end_loc != -1) {
+          end_loc += window_start;
+        }
+      }
+      return start_loc;
+    }
+
+    /**
+     * The text a located patch actually covers.
+     */
+    private string patch_matchedText(string text, string text1, int start_loc,
+        int end_loc) {
+      if (end_loc == -1) {
+        return text.JavaSubstring(start_loc,
+            Math.Min(start_loc + text1.Length, text.Length));
+      }
+      return text.JavaSubstring(start_loc,
+          Math.Min(end_loc + this.Match_MaxBits, text.Length));
+    }
+
+    /**
+     * Apply the changes of a patch to the text it is located at.
+     * @param aPatch The patch.
+     * @param text1 Source text of the patch.
+     * @param text2 Text the patch is located at.
+     * @param replacement The changed text.
+     * @return False if the content is unacceptably different.
+     */
+    private bool patch_splice(Patch aPatch, string text1, string text2,
+        out string replacement) {
+      if (text1 == text2) {
+        // Perfect match, just shove the Replacement text in.
+        replacement = diff_text2(aPatch.diffs);
+        return true;
+      }
+
+      // Imperfect match.  Run a diff to get a framework of equivalent
+      // indices.
+      replacement = text2;
+      List<Diff> diffs = diff_main(text1, text2, false);
+      if (text1.Length > this.Match_MaxBits
+          && this.diff_levenshtein(diffs) / (float) text1.Length
+          > this.Patch_DeleteThreshold) {
+        // The end points match, but the content is unacceptably bad.
+        return false;
+      }
+      diff_cleanupSemanticLossless(diffs);
+      int index1 = 0;
+      foreach (Diff aDiff in aPatch.diffs) {
+        if (aDiff.operation != Operation.EQUAL) {
+          int index2 = diff_xIndex(diffs, index1);
+          if (aDiff.operation == Operation.INSERT) {
+            // Insertion
+            replacement = replacement.Insert(index2, aDiff.text);
+          } else if (aDiff.operation == Operation.DELETE) {
+            // Deletion
+            replacement = replacement.Remove(index2, diff_xIndex(diffs,
+                index1 + aDiff.text.Length) - index2);
+          }
+        }
+        if (aDiff.operation != Operation.DELETE) {
+          index1 += aDiff.text.Length;
+        }
+      }
+      return true;
+    }
+
+    /**
+     * Locate where the source text of a patch is in the text.
+     * Intended to be called on patches after patch_addPadding and
+     * patch_splitMax.
+     * @param text Text to search, with padding.
+     * @param text1 Source text of the patch.
+     * @param expected_loc The location to search around.
+     * @param threshold At what point is no match declared.
+     * @param end_loc Start of the trailing context for oversized patterns,
+     *     or -1.
+     * @return Best match index or -1.
+     */
+    public int patch_locate(string text, string text1, int expected_loc,
+        double threshold, out int end_loc) {
+      int start_loc;
+      end_loc = -1;
+      if (text1.Length > this.Match_MaxBits) {
+        // patch_splitMax will only provide an oversized pattern
+        // in the case of a monster delete.
+        start_loc = match_main(text,
+            text1.Substring(0, this.Match_MaxBits), expected_loc, threshold);
+        if (start_loc != -1) {
+          end_loc = match_main(text,
+              text1.Substring(text1.Length - this.Match_MaxBits),
+              expected_loc + text1.Length - this.Match_MaxBits, threshold);
+          if (end_loc == -1 || start_loc >= end_loc) {
+            // Can't find valid trailing context.  Drop this patch.
+            start_loc = -1;
+          }
+        }
+      } else {
+        start_loc = this.match_main(text, text1, expected_loc, threshold);
+      }
+      return start_loc;
+    }
+
+    /**
+     * Compute the start offset of every line in the text.
+     * @param text Text to index.
+     * @return Start offsets in ascending order, followed by the text length.
+     */
+    public int[] match_lineStarts(string text) {
+      List<int> starts = new List<int> { 0 };
+      for (int i = text.IndexOf('\n'); i >= 0 && i + 1 < text.Length;
+          i = text.IndexOf('\n', i + 1)) {
+        starts.Add(i + 1);
+      }
+      starts.Add(text.Length);
+      return starts.ToArray();
+    }
+
+    /**
+     * Compute the range to search for a pattern expected at some location,
+     * Match_LineDistance lines around it.
+     * @param line_starts Line offsets from match_lineStarts.
+     * @param loc The location to search around.
+     * @param length Length of the pattern, which may reach beyond the last line.
+     * @param start Start of the range.
+     * @param end End of the range.
+     */
+    public void match_lineWindow(int[] line_starts, int loc, int length,
+        out int start, out int end) {
+      int line = Array.BinarySearch(line_starts, 0, line_starts.Length - 1,
+          Math.Max(loc, 0));
+      if (line < 0) {
+        line = Math.Max(~line - 1, 0);
+      }
+      int first = Math.Max(line - Match_LineDistance, 0);
+      int last = (int)Math.Min((long)line + Match_LineDistance + 1,
+          line_starts.Length - 1);
+      start = line_starts[first];
+      end = line_starts[last] + length;
+    }
+
     /**
      * Add some padding on text start and end so that edges can match something.
      * Intended to be called only from within patch_apply.